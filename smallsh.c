@@ -9,390 +9,9390 @@
 #include <fcntl.h>
 #include <sys/wait.h>
 #include <signal.h>
+#include <spawn.h>
+#include <time.h>
+#include <errno.h>
+#include <stdint.h>
+#include <ctype.h>
+#include <sys/stat.h>
+#include <limits.h>
+#include <stdarg.h>
+#include <sys/uio.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#include <sched.h>
+#include <sys/time.h>
+#include <execinfo.h>
+#include <glob.h>
+#include <sys/mman.h>
+#if defined(__x86_64__) || (defined(__i386__) && defined(__SSE2__))
+#include <immintrin.h>
+#define HAVE_SSE2 1
+#endif
 
 #define MAX_CMD_CHARS 2048
 #define MAX_CMD_ARGS 512
 #define DELIM " \t\n"
+#define SPECIAL "'\"\\<>&|()"
 #define DEVNULL "/dev/null"
+#define JOURNAL_SYNC_MS 100
+#define INPUT_BLOCK 65536
+#define OUTPUT_SIZE 8192
+#define OUTPUT_IOV 64
+#define CACHE_DIR ".smallsh_cache"
+#define CACHE_ENV "PATH:LANG:LC_ALL"
+#define FNV_OFFSET 14695981039346656037ULL
+#define FNV_PRIME 1099511628211ULL
+#define TASK_PENDING 0
+#define TASK_RUNNING 1
+#define TASK_DONE 2
+#define TASK_FAILED 3
+#define TASK_SKIPPED 4
+#define CMD_SIMPLE 0
+#define CMD_FUNCTION 1
+#define CMD_WHILE 2
+#define CMD_CASE 3
+#define DEFAULT_IFS " \t\n"
+#define NAME_TABLE_SIZE 64
+#define MAX_ALIAS_DEPTH 16
+#define MAX_CALL_DEPTH 256
+#define ARITH_NUM 0
+#define ARITH_VAR 1
+#define ARITH_UNARY 2
+#define ARITH_BINARY 3
+#define ARITH_ASSIGN 4
+#define ARITH_TERNARY 5
+#define ARITH_PREINC 6
+#define ARITH_POSTINC 7
+#define NICE_KEEP 100
+#define STATS_BUCKETS 400
+#define METRICS_MS 1000
+#define SPAWN_BUCKETS 8
+#define PROFILE_HZ 997
+#define PROFILE_DEPTH 64
+#define PROFILE_RING 4096
+#define RECORD_MAGIC "SMSHREC1"
+#define PATH_CACHE_SIZE 64
+#define PAT_CHAR 0
+#define PAT_ANY 1
+#define PAT_SET 2
+#define PAT_STAR 3
+#define MAX_BRACES 32
+#define BRACE_LIMIT 1000000
+#define IOPRIO_WHO_PROCESS 1
+#define IOPRIO_CLASS_SHIFT 13
+#define IOPRIO_CLASS_BE 2
+#define IOPRIO_CLASS_IDLE 3
+#ifndef SCHED_BATCH
+#define SCHED_BATCH 3
+#endif
+#ifndef SCHED_IDLE
+#define SCHED_IDLE 5
+#endif
+#ifndef MADV_WIPEONFORK
+#define MADV_WIPEONFORK 18
+#endif
 
 // struct for command line information
 struct Command
 {
-	// array that holds the commands or arguments
-	char *argv[MAX_CMD_ARGS];
+	// array that holds the commands or arguments, grown as needed
+	char **argv;
 
 	// int that tracks the argument count
 	int argc;
 
+	// int that tracks the room in argv, including the final NULL
+	int argCap;
+
 	// bool to track if background command given
 	int isBgProcess;
 
 	// bool to track if command wants input redirection
 	int wantsInputR;
 
-	// bool to track if command wants output redirection
-	int wantsOutputR;
+	// bool to track if command wants output redirection
+	int wantsOutputR;
+
+	// pointer to filename for input redirection
+	char *inRedirFile;
+
+	// pointer to filename for output redirection
+	char *outRedirFile;
+
+	// input line number the command was read from
+	long lineNo;
+
+	// kind of command, one of the CMD_ values
+	int type;
+
+	// condition of a while loop
+	struct Command *cond;
+
+	// parsed commands inside a compound command, in order
+	struct Command **body;
+
+	// number of commands in body
+	int bodyCount;
+
+	// arithmetic expressions in the words, compiled the first time they are expanded
+	struct ArithCache *arith;
+
+	// number of expressions in arith
+	int arithCount;
+
+	// next stage of a pipeline, NULL for the last one
+	struct Command *next;
+
+	// input line the command was parsed from, kept only while recording
+	char *text;
+
+	// holders of the struct, freeCommand only frees it once the last one lets go,
+	// so a function redefined or unset while it runs keeps its body until it returns
+	int refs;
+
+	// patterns of a case statement, compiled the first time it runs unless they
+	// need expanding
+	struct Matcher *matcher;
+};
+
+// struct for one step of a compiled glob pattern
+struct PatternOp
+{
+	// one of the PAT_ values
+	unsigned char type;
+
+	// byte for PAT_CHAR
+	unsigned char c;
+
+	// index of the byte set for PAT_SET
+	unsigned short set;
+};
+
+// struct for a compiled glob pattern
+struct Pattern
+{
+	struct PatternOp *ops;
+	int count;
+
+	// literal bytes every match starts with, checked before matching
+	char *prefix;
+	int prefixLen;
+
+	// shortest word that can match, and bool to track if longer ones can too
+	int minLen;
+	int hasStar;
+
+	// case branch the pattern belongs to
+	int branch;
+};
+
+// struct for a set of patterns tried in order, with byte tables that rule out
+// most of them before any matching is done
+struct Matcher
+{
+	struct Pattern *patterns;
+	int count;
+
+	// byte sets of bracket expressions, a bit per byte
+	unsigned char (*sets)[32];
+	int setCount;
+
+	// for every byte, a bit per pattern that a word starting or ending with the
+	// byte may match, words uint64_t per byte
+	uint64_t *first;
+	uint64_t *last;
+
+	// bit per pattern that matches the empty word
+	uint64_t *empty;
+	int words;
+};
+
+// struct for a brace group in a word, either a list like {a,b} or a range like
+// {1..10..2} or {a..z}
+struct Brace
+{
+	// offsets of the braces in the word
+	int open;
+	int close;
+
+	// number of words the group stands for
+	int64_t count;
+
+	// for a list, offsets of the commas between its words
+	int commas[MAX_CMD_ARGS];
+
+	// for a range, the first value, step, zero padded width and bool to track if
+	// the values are characters
+	int64_t from;
+	int64_t step;
+	int width;
+	int isChar;
+};
+
+// struct for one node of a compiled $((...)) expression
+struct Arith
+{
+	// kind of node, one of the ARITH_ values
+	int type;
+
+	// operator, with two character operators like '<<' packed as 'l' and so on
+	int op;
+
+	// value of a number
+	int64_t value;
+
+	// variable name for variables, assignments and increments
+	char *name;
+
+	// operands, the third only for ?:
+	struct Arith *left;
+	struct Arith *right;
+	struct Arith *third;
+};
+
+// struct for an expression compiled from a command's word, found again by its
+// text, since words are expanded from copies that do not outlive the expansion
+struct ArithCache
+{
+	char *text;
+	size_t len;
+	struct Arith *tree;
+};
+
+// struct for one slot of the name table that maps a command name to the
+// built-in, alias and function it may stand for
+struct Name
+{
+	// name looked up, NULL for a slot never used and TOMBSTONE for a removed one
+	char *key;
+
+	// built-in to run, NULL if the name is not a built-in
+	int (*builtin)(struct Command *cmdInfo);
+
+	// alias value as given and the command parsed from it, NULL if not an alias
+	char *aliasText;
+	struct Command *alias;
+
+	// function definition, NULL if the name is not a function
+	struct Command *function;
+
+	// statistics for the children run under the name, NULL if none ended yet
+	struct Stats *stats;
+
+	// shell variable value, NULL if the name is not a variable
+	char *value;
+
+	// bool to track if the variable is passed on to children
+	int exported;
+};
+
+// struct for the open addressing hash table of names
+struct NameTable
+{
+	// slots, a power of two of them
+	struct Name *slots;
+	size_t cap;
+
+	// slots holding a name or a tombstone
+	size_t used;
+};
+
+// struct for the batch journal used by --journal and --resume
+struct Journal
+{
+	// file descriptor of the journal file, -1 when journaling is off
+	int fd;
+
+	// minimum milliseconds between fsyncs (group commit window)
+	long syncMs;
+
+	// bool to track if records were written since the last fsync, also cleared
+	// by the sync timer
+	volatile sig_atomic_t dirty;
+
+	// time of the last fsync
+	struct timespec lastSync;
+
+	// byte map of line numbers that already completed successfully
+	char *done;
+
+	// size of the done map
+	long doneSize;
+};
+
+// struct for the session log written by --record and read by --replay. The log
+// starts with RECORD_MAGIC, then each command run in a child is one record: its
+// payload size, then line number, exit status and run time in nanoseconds, the
+// working directory, the environment entries changed since the last record
+// ('NAME=value', or 'NAME' once removed), the background flag and the stages, each
+// with its arguments and redirect files, and last the input line as typed. A
+// background command has no exit status or run time of its own yet, both are 0.
+// Numbers are in host byte order and strings are a length counting the NUL, 0 for
+// none, followed by the bytes.
+struct Recorder
+{
+	// log being written, NULL when recording is off
+	FILE *file;
+
+	// environment as of the last record
+	char **env;
+	int envCount;
+};
+
+// struct for a command name resolved against PATH
+struct PathEntry
+{
+	char *name;
+
+	// full path, NULL if the command was not found
+	char *path;
+
+	// times the cached path was used to start the command
+	long hits;
+
+	// bool to track if the binary was already prefetched
+	int prefetched;
+};
+
+// struct for the table of command names resolved against PATH, kept in a
+// cacheAlloc mapping so a forked copy of the shell finds it empty
+struct PathCache
+{
+	// open addressing table, a power of two of slots
+	struct PathEntry *slots;
+	size_t cap;
+	size_t used;
+
+	// PATH the entries were resolved with
+	char *pathVar;
+};
+
+// struct for a script line --auto-parallel started before the lines ahead of it
+// had finished
+struct ParallelLine
+{
+	pid_t pid;
+
+	// bool to track if it ended, and its wait status
+	int done;
+	int status;
+
+	// unlinked temporary files holding its stdout and stderr until its turn
+	int outFd;
+	int errFd;
+
+	// files it reads and writes, from its redirections and '#@' annotations
+	char **reads;
+	int readCount;
+	char **writes;
+	int writeCount;
+
+	// prompts shown for it and the blank or comment lines before it
+	char *prompt;
+};
+
+// struct for --auto-parallel, which runs script lines that touch different files
+// at the same time while printing their output and status in script order
+struct Parallel
+{
+	// most lines running at once, 0 when --auto-parallel is off
+	int limit;
+
+	// lines started and not yet printed, oldest first
+	struct ParallelLine *lines;
+	int count;
+
+	// files the last '#@' line named for the next command
+	char **reads;
+	int readCount;
+	char **writes;
+	int writeCount;
+
+	// bool to track if a '#@' line came before the next command, even one naming
+	// no files
+	int annotated;
+
+	// prompts held back until the lines before them are printed
+	char *prompt;
+	size_t promptLen;
+	size_t promptCap;
+};
+
+// struct for the read-ahead buffer commands are read from
+struct Input
+{
+	// file descriptor commands are read from
+	int fd;
+
+	// bool to track if fd can be seeked, so unread input can be handed back
+	int seekable;
+
+	// bool to track if the end of input was reached
+	int eof;
+
+	// buffered bytes, unread ones are buf[start] up to buf[end]
+	char *buf;
+	size_t start;
+	size_t end;
+	size_t cap;
+};
+
+// struct for the file descriptors and reader state replaced while redirections
+// are applied in the shell process itself
+struct Frame
+{
+	// duplicates of the original stdin and stdout, -1 if not replaced
+	int savedIn;
+	int savedOut;
+
+	// reader state for the original stdin
+	struct Input savedLineReader;
+	int savedSeekable;
+};
+
+// struct for output waiting to be written to stdout in a single writev
+struct Output
+{
+	// formatted text, referenced by the segments below
+	char buf[OUTPUT_SIZE];
+
+	// bytes of buf in use
+	size_t len;
+
+	// segments in the order they will be written
+	struct iovec iov[OUTPUT_IOV];
+
+	// number of segments in use
+	int count;
+};
+
+// struct for one node of the task graph run by the 'tasks' built-in
+struct Task
+{
+	// name other tasks use to depend on this one
+	char *name;
+
+	// names of the tasks this one depends on
+	char **depNames;
+
+	// indexes of the tasks this one depends on, resolved from depNames
+	int *deps;
+
+	// number of dependencies and the room for them in depNames and deps
+	int depCount;
+	int depCap;
+
+	// number of dependencies that have not finished successfully yet
+	int waiting;
+
+	// command to run, NULL if the task only groups dependencies
+	struct Command *cmd;
+
+	// one of the TASK_ states
+	int state;
+
+	// process id while running
+	pid_t pid;
+
+	// wait status once finished
+	int status;
+
+	// start and end times of the command
+	struct timespec start;
+	struct timespec end;
+
+	// longest chain of finished work ending at this task and the task before it
+	double pathSecs;
+	int pathPrev;
+};
+
+// struct for the priority a child runs with, set by the 'sched' built-in
+struct Priority
+{
+	// nice value, NICE_KEEP to leave it alone
+	int nice;
+
+	// I/O class and level within it, class 0 to leave it alone
+	int ioClass;
+	int ioLevel;
+
+	// scheduling policy such as SCHED_BATCH, -1 to leave it alone
+	int policy;
+};
+
+// struct for a child process still running
+struct Job
+{
+	pid_t pid;
+
+	// command name, for listing and statistics
+	char *name;
+
+	// bool to track if the child runs in the background
+	int background;
+
+	// time the job started
+	struct timespec start;
+
+	// how far the scheduler has lowered the job's priority so far
+	int level;
+
+	// priority the job was started with, the scheduler never goes above it
+	struct Priority prio;
+};
+
+// struct for the counters written out by --metrics
+struct Metrics
+{
+	// file the metrics are written to, NULL when the exporter is off
+	char *path;
+
+	// time of the last write
+	struct timespec lastWrite;
+
+	// commands run, children started, children reaped and lines that failed to parse
+	long commands;
+	long launched;
+	long reaped;
+	long parseErrors;
+
+	// histogram of the time posix_spawn or fork took, by SPAWN_LIMITS
+	long spawnBuckets[SPAWN_BUCKETS];
+	double spawnSecs;
+};
+
+// struct for one stack sampled by the profiler
+struct ProfileSample
+{
+	// return addresses, innermost first
+	void *pcs[PROFILE_DEPTH];
+	int depth;
+
+	// number of times the stack was seen, once merged
+	long count;
+};
+
+// struct for the --profile sampler. The signal handler adds samples to a ring
+// that the shell drains into a hash table of distinct stacks between commands.
+struct Profile
+{
+	// file the folded stacks are written to, NULL when profiling is off
+	char *path;
+
+	// ring of raw samples, head moved only by the handler and tail only outside it
+	struct ProfileSample *ring;
+	volatile unsigned int head;
+	volatile unsigned int tail;
+
+	// samples lost to a full ring
+	volatile long dropped;
+
+	// open addressing table of distinct stacks, a power of two of them
+	struct ProfileSample *stacks;
+	size_t cap;
+	size_t used;
+};
+
+// struct for the statistics kept per command name as children end
+struct Stats
+{
+	// children that ended, and how many of them failed
+	long count;
+	long failures;
+
+	// largest resident set of any of them in kilobytes
+	long maxRss;
+
+	// run times in microseconds on a log scale with 8 buckets per power of two,
+	// see statsBucket
+	uint32_t buckets[STATS_BUCKETS];
+};
+
+
+void initCommand(struct Command *cmdInfo);
+void freeCommand(struct Command *garbage);
+struct Command* getCommand();
+int parseCommand(char *line, struct Command *cmdInfo);
+const char* skipQuoted(const char *p);
+void addArg(struct Command *cmdInfo, char *arg);
+char* readLine(struct Input *in);
+void inputFill(struct Input *in);
+int inputDone(struct Input *in);
+void inputSync();
+void outPrintf(const char *format, ...);
+void outWrite(const char *text, size_t len);
+void outFlush();
+void initScanner();
+const char* scanScalar(const char *p, const char *end);
+#ifdef HAVE_SSE2
+const char* scanSse2(const char *p, const char *end);
+const char* scanAvx2(const char *p, const char *end);
+#endif
+void benchScanner();
+void benchFork();
+void* cacheAlloc(size_t size);
+void cacheFree(void *cache, size_t size);
+int execCommand(struct Command *cmdInfo);
+int runCommand(struct Command *cmdInfo);
+int runPipeline(struct Command *raw);
+int runStages(struct Command **stages, int count);
+int errExit();
+int parseCompound(struct Command *cmdInfo);
+int readBody(struct Command *cmdInfo, const char *terminator);
+int readCase(struct Command *cmdInfo);
+int runCase(struct Command *cmdInfo);
+struct Matcher* matcherCompile(char **texts, int *branches, int count);
+void patternCompile(struct Matcher *matcher, const char *text, struct Pattern *pattern);
+int matcherFind(struct Matcher *matcher, const char *word);
+int patternMatch(struct Matcher *matcher, struct Pattern *pattern, const char *word, int len);
+void matcherFree(struct Matcher *matcher);
+struct Command* applyAlias(struct Command *cmdInfo);
+struct Command* expandCommand(struct Command *raw);
+int expandBraces(struct Command *raw, struct Command *cmdInfo, const char *word, int depth);
+int braceParse(const char *word, int open, struct Brace *brace);
+int expandWord(struct Command *raw, struct Command *cmdInfo, char *word);
+char* expandText(struct Command *raw, const char *word, char **mask);
+char* globEscape(const char *text, const char *mask);
+void appendText(char **text, size_t *len, size_t *cap, const char *add, size_t addLen);
+void appendMasked(char **text, char **mask, size_t *len, size_t *cap, const char *add, size_t addLen, int quoted);
+int isAssignment(const char *word);
+const char* nameEnd(const char *word);
+const char* getVar(const char *key);
+void setVar(const char *key, const char *value);
+struct Arith* arithCompile(struct Command *raw, const char *at, size_t len);
+struct Arith* arithParse(const char **p, int level);
+struct Arith* arithUnary(const char **p);
+struct Arith* arithNode(int type, int op, struct Arith *left, struct Arith *right);
+int arithOperator(const char **p, int level);
+int64_t arithEval(struct Arith *node, int *error);
+int64_t arithApply(int op, int64_t left, int64_t right, int *error);
+void arithFree(struct Arith *node);
+int callFunction(struct Command *function, struct Command *cmdInfo);
+int runWhile(struct Command *loop);
+int pushFrame(struct Command *cmdInfo, struct Frame *frame);
+void popFrame(struct Frame *frame);
+int lastStatus();
+void initNames();
+struct Name* lookupName(const char *key);
+struct Name* insertName(const char *key);
+void releaseName(struct Name *name);
+int builtinExit(struct Command *cmdInfo);
+int builtinStatus(struct Command *cmdInfo);
+int builtinCd(struct Command *cmdInfo);
+int builtinPwd(struct Command *cmdInfo);
+int builtinPushd(struct Command *cmdInfo);
+int builtinPopd(struct Command *cmdInfo);
+int builtinDirs(struct Command *cmdInfo);
+int builtinTasks(struct Command *cmdInfo);
+int builtinCached(struct Command *cmdInfo);
+int builtinAlias(struct Command *cmdInfo);
+int builtinUnalias(struct Command *cmdInfo);
+int builtinUnset(struct Command *cmdInfo);
+int builtinReturn(struct Command *cmdInfo);
+int builtinExport(struct Command *cmdInfo);
+int builtinRead(struct Command *cmdInfo);
+int builtinBreak(struct Command *cmdInfo);
+int builtinSet(struct Command *cmdInfo);
+int builtinSched(struct Command *cmdInfo);
+int builtinJobstats(struct Command *cmdInfo);
+int builtinExec(struct Command *cmdInfo);
+int execReplace(struct Command *cmdInfo);
+int canTailExec(struct Command *cmdInfo);
+int builtinHash(struct Command *cmdInfo);
+struct PathEntry* pathLookup(const char *command, int retry);
+char* pathSearch(const char *command);
+void pathForget();
+void prefetchNext();
+void showPrompt(const char *text);
+int parallelStep(struct Command *cmdInfo);
+int parallelEligible(struct Command *cmdInfo);
+void parallelAnnotate(struct Command *cmdInfo);
+int runParallel(struct Command *cmdInfo);
+int parallelConflicts(struct ParallelLine *line);
+int parallelWait();
+int parallelRetire();
+int parallelDrain();
+int parallelReaped(pid_t pid, int status);
+void parallelCopy(int fd, int to);
+int parallelTemp();
+void addFile(char ***files, int *count, char *file);
+void freeFiles(char **files, int count);
+void initSpawn();
+pid_t spawnCommand(struct Command *cmdInfo, int inPipe, int outPipe);
+void cleanUp();
+void reportBgExit(pid_t childPid, int status);
+void startJob(pid_t pid, struct Command *cmdInfo, const struct timespec *start);
+void endJob(pid_t pid, int status, const struct rusage *usage);
+int statsBucket(uint64_t micros);
+double statsPercentile(const struct Stats *stats, double fraction);
+void printStats(FILE *file);
+void rescheduleJobs();
+int policyRank(int policy);
+int ioRank(int ioClass, int ioLevel);
+int applyPriority(pid_t pid, const struct Priority *prio);
+int waitForeground(pid_t pid);
+void recordStatus(int status);
+void runCached(struct Command *cmdInfo);
+int cacheDir(char *dir, size_t size);
+void cacheResult(struct Command *cmdInfo, const char *dir, uint64_t hash, char **outputs,
+	int outCount);
+void initDirs();
+int changeDir(const char *target);
+void printDirs();
+uint64_t hashBytes(uint64_t hash, const void *data, size_t len);
+uint64_t hashFile(uint64_t hash, const char *path, int statOnly);
+int copyFile(const char *path, int toFd);
+double timeDiff(const struct timespec *start, const struct timespec *end);
+int runTasks(const char *path, int maxJobs);
+int loadTasks(FILE *file, struct Task **tasks, int *count);
+void finishTask(struct Task *tasks, int count, int index);
+void freeTasks(struct Task **tasks, int *count);
+void shutdownShell();
+void metricsWrite(int force);
+pid_t waitChild(pid_t pid, int *status, struct rusage *usage);
+void profileStart();
+void profileSignal(int signo);
+void profileDrain();
+void profileWrite();
+int journalOpen(const char *path, int resume);
+int journalSkip(struct Command *cmdInfo);
+void journalRecord(struct Command *cmdInfo);
+void journalSync(int force);
+void journalAlarm(int signo);
+void journalClose();
+int recordOpen(const char *path);
+void recordCommand(struct Command **stages, int count, const struct timespec *began);
+void recordClose();
+void putString(char **buf, size_t *len, size_t *cap, const char *text);
+const char* getString(const char **p, const char *end);
+int replaySession(const char *path);
+
+
+// global for easy signal handling
+struct sigaction action;
+
+// global spawn attributes computed once by initSpawn, giving foreground children
+// default handling for the signals the shell ignores or handles and background
+// children the same except that SIGINT stays ignored, both with nothing blocked
+posix_spawnattr_t fgSpawnAttr;
+posix_spawnattr_t bgSpawnAttr;
+
+// global environment handed to children
+extern char **environ;
+
+// global string that holds process exit/termination state
+char ENDSTATE[MAX_CMD_CHARS] = "NULL";
+
+// global reader the shell reads commands from, stdin unless a script is given
+struct Input reader = { 0, 0, 0, NULL, 0, 0, 0 };
+
+// global reader 'read' uses when stdin is not where commands come from
+struct Input lineReader = { 0, 0, 0, NULL, 0, 0, 0 };
+
+// global count of redirect frames that have replaced stdin
+int STDINFRAMES = 0;
+
+// global count of input lines read so far
+long LINENO = 0;
+
+// global SIGALRM handling that syncs the journal
+struct sigaction alarmAction;
+
+// global batch journal, inactive until opened
+struct Journal journal = { -1, JOURNAL_SYNC_MS, 0, { 0, 0 }, NULL, 0 };
+
+// global session recorder, inactive until opened
+struct Recorder recorder = { NULL, NULL, 0 };
+
+// global input line of the command being run, for the session log
+const char *LINETEXT = NULL;
+
+// global cache of command paths behind 'hash'
+struct PathCache pathCache;
+
+// global stdout buffer, flushed once per shell loop and before children start
+struct Output output;
+
+// global scanner that finds the next delimiter or special character in a line,
+// picked for the running CPU by initScanner
+const char* (*scanSpecial)(const char *p, const char *end) = scanScalar;
+
+// global byte map of the characters scanSpecial stops at
+unsigned char SPECIALMAP[256];
+
+// global logical working directory, kept in step with the PWD environment variable
+char PWD[PATH_MAX];
+
+// global directory stack for pushd and popd, top of the stack last
+char *DIRSTACK[MAX_CMD_ARGS];
+int DIRCOUNT = 0;
+
+// global hit and miss counts for the 'cached' prefix
+long CACHEHITS = 0;
+long CACHEMISSES = 0;
+
+// global table of built-ins, aliases and functions
+struct NameTable names = { NULL, 0, 0 };
+
+// global marker for removed name table slots
+char TOMBSTONE[] = "";
+
+// global positional parameters, POSARGS[0] is $0 and POSCOUNT does not count it
+char **POSARGS;
+int POSCOUNT = 0;
+
+// global function call depth and bool to track if 'return' was run
+int CALLDEPTH = 0;
+int RETURNING = 0;
+
+// global loop depth and bools to track if 'break' or 'continue' was run
+int LOOPDEPTH = 0;
+int BREAKING = 0;
+int CONTINUING = 0;
+
+// global shell options changed by 'set'
+// -e ends the shell once a command fails, -u makes expanding an unset variable an
+// error, and pipefail gives a pipeline the value of its last stage that failed
+int ERREXIT = 0;
+int NOUNSET = 0;
+int PIPEFAIL = 0;
+
+// global depth of while conditions being run, where -e does not apply
+int CONDDEPTH = 0;
+
+// global bool to track if -e ended the shell
+int ERRABORT = 0;
+
+// global bool to track if this is a forked copy of the shell running one stage
+// of a pipeline
+int SUBSHELL = 0;
+
+// global bool to track if commands come from a script or -c rather than a user,
+// and bool to track if the next command may replace the shell since nothing is
+// left to run after it
+int SCRIPTED = 0;
+int TAILEXEC = 0;
+
+// global priority for background jobs, and the one given to the command run by
+// 'sched', which wins over it
+struct Priority BGPRIORITY = { NICE_KEEP, 0, 0, -1 };
+struct Priority *CMDPRIORITY = NULL;
+
+// global table of children still running
+struct Job *JOBS = NULL;
+int JOBCOUNT = 0;
+
+// global path the per command statistics are written to on exit, NULL for none
+char *STATSPATH = NULL;
+
+// global counters for the metrics exporter
+struct Metrics metrics;
+
+// global state of --auto-parallel, off until given
+struct Parallel parallel;
+
+// global profiler, off until --profile is given
+struct Profile profile;
+
+// global upper bounds in seconds of the spawn latency buckets, the last is +Inf
+const double SPAWN_LIMITS[SPAWN_BUCKETS - 1] = { 0.0001, 0.00025, 0.0005, 0.001, 0.0025, 0.005, 0.01 };
+
+// global seconds a background job runs before the scheduler lowers its priority
+// a step, 0 when the scheduler is off
+double AUTOSCHED = 0;
+
+int main(int argc, char *argv[])
+{
+	// shell loop condition
+	int exitCalled = 0;
+
+	// option values
+	int i;
+	int resume = 0;
+	char *journalPath = NULL;
+	char *recordPath = NULL;
+	char *replayPath = NULL;
+	char *scriptPath = NULL;
+	char *commandText = NULL;
+
+	struct Command *cmdInfo;
+
+	// parse command line options, anything else is taken as the script to run
+	for (i = 1; i < argc; i++)
+	{
+		if (strncmp(argv[i], "--journal=", 10) == 0)
+		{
+			journalPath = argv[i] + 10;
+		}
+		else if (strncmp(argv[i], "--journal-sync=", 15) == 0)
+		{
+			journal.syncMs = atol(argv[i] + 15);
+		}
+		else if (strcmp(argv[i], "--resume") == 0)
+		{
+			resume = 1;
+		}
+		else if (strncmp(argv[i], "--jobstats=", 11) == 0)
+		{
+			STATSPATH = argv[i] + 11;
+		}
+		else if (strncmp(argv[i], "--metrics=", 10) == 0)
+		{
+			metrics.path = argv[i] + 10;
+		}
+		else if (strncmp(argv[i], "--profile=", 10) == 0)
+		{
+			profile.path = argv[i] + 10;
+		}
+		else if (strncmp(argv[i], "--record=", 9) == 0)
+		{
+			recordPath = argv[i] + 9;
+		}
+		else if (strncmp(argv[i], "--replay=", 9) == 0)
+		{
+			replayPath = argv[i] + 9;
+		}
+		else if (strcmp(argv[i], "--bench-scan") == 0)
+		{
+			initScanner();
+			benchScanner();
+			return 0;
+		}
+		else if (strcmp(argv[i], "--auto-parallel") == 0)
+		{
+			parallel.limit = (int)sysconf(_SC_NPROCESSORS_ONLN);
+		}
+		else if (strncmp(argv[i], "--auto-parallel=", 16) == 0)
+		{
+			parallel.limit = atoi(argv[i] + 16);
+			parallel.limit = parallel.limit > 0 ? parallel.limit : 1;
+		}
+		else if (strcmp(argv[i], "--bench-fork") == 0)
+		{
+			benchFork();
+			return 0;
+		}
+		else if (strcmp(argv[i], "-c") == 0 && i + 1 < argc)
+		{
+			// the words after the commands are $0 and on
+			commandText = argv[++i];
+			break;
+		}
+		else if (argv[i][0] != '-')
+		{
+			// the script is $0 and the arguments after it are $1 and on
+			scriptPath = argv[i];
+			break;
+		}
+		else
+		{
+			fprintf(stderr, "usage: smallsh [--journal=FILE] [--journal-sync=MS] [--resume] [--jobstats=FILE] [--metrics=FILE] [--profile=FILE]\n       [--record=FILE | --replay=FILE] [--auto-parallel[=N]]\n       [script [args] | -c commands [name [args]]]\n");
+			return 2;
+		}
+	}
+
+	POSARGS = scriptPath ? argv + i : argv;
+	POSCOUNT = scriptPath ? argc - i - 1 : 0;
+	SCRIPTED = scriptPath != NULL || commandText != NULL;
+
+	if (commandText != NULL && i + 1 < argc)
+	{
+		POSARGS = argv + i + 1;
+		POSCOUNT = argc - i - 2;
+	}
+
+	// resuming only makes sense with a journal to resume from
+	if (resume == 1 && journalPath == NULL)
+	{
+		fprintf(stderr, "--resume requires --journal=FILE\n");
+		return 2;
+	}
+
+	if (recordPath != NULL && replayPath != NULL)
+	{
+		fprintf(stderr, "--record and --replay cannot be used together\n");
+		return 2;
+	}
+
+	// lines finish out of order, which a journal or recording cannot follow
+	if (parallel.limit > 0 && (SCRIPTED == 0 || journalPath != NULL || recordPath != NULL || replayPath != NULL))
+	{
+		fprintf(stderr, "--auto-parallel needs a script or -c, and no --journal, --record or --replay\n");
+		return 2;
+	}
+
+	// read commands from the script instead of stdin if one was given
+	// children still inherit the shell's own stdin
+	if (scriptPath != NULL)
+	{
+		reader.fd = open(scriptPath, O_RDONLY | O_CLOEXEC);
+
+		if (reader.fd == -1)
+		{
+			fprintf(stderr, "cannot open %s\n", scriptPath);
+			return 1;
+		}
+	}
+
+	// commands given with -c are all the input there is
+	if (commandText != NULL)
+	{
+		reader.fd = -1;
+		reader.end = strlen(commandText);
+		reader.cap = reader.end + 1;
+		reader.buf = malloc(reader.cap);
+		memcpy(reader.buf, commandText, reader.end);
+		reader.eof = 1;
+	}
+
+	// only input shared with children needs its offset kept right
+	lineReader.seekable = lseek(0, 0, SEEK_CUR) != -1;
+	reader.seekable = reader.fd == 0 && lineReader.seekable;
+
+	if (journalPath != NULL && journalOpen(journalPath, resume) == -1)
+	{
+		fprintf(stderr, "cannot open %s for journal\n", journalPath);
+		return 1;
+	}
+
+	if (recordPath != NULL && recordOpen(recordPath) == -1)
+	{
+		fprintf(stderr, "cannot open %s for recording\n", recordPath);
+		return 1;
+	}
+
+	initDirs();
+	initScanner();
+	initNames();
+
+	// set signal handling to prevent signal interuption
+	// this will be inherited unless changed later
+	action.sa_handler = SIG_IGN;
+	sigaction(SIGINT, &action, NULL);
+	initSpawn();
+	profileStart();
+
+	// a replay runs the recorded commands instead of reading any
+	if (replayPath != NULL)
+	{
+		i = replaySession(replayPath);
+		shutdownShell();
+		return i;
+	}
+
+	do
+	{
+		cleanUp();
+		cmdInfo = getCommand();
+
+		// end of input behaves like a quiet exit
+		if (cmdInfo == NULL)
+		{
+			break;
+		}
+
+		// the next command's binary is read in while this one runs
+		prefetchNext();
+
+		// lines that touch different files may run at the same time
+		if (parallel.limit > 0)
+		{
+			exitCalled = parallelStep(cmdInfo);
+		}
+		// lines that already completed in a previous run are not run again
+		else if (journalSkip(cmdInfo) == 0)
+		{
+			TAILEXEC = canTailExec(cmdInfo);
+			exitCalled = execCommand(cmdInfo);
+			TAILEXEC = 0;
+			journalRecord(cmdInfo);
+		}
+
+		freeCommand(cmdInfo);
+		LINETEXT = NULL;
+	}while (exitCalled == 0);
+
+	// the lines still running come before the last prompt
+	if (exitCalled == 0 && parallelDrain() == 0)
+	{
+		showPrompt("");
+	}
+
+	shutdownShell();
+
+	// a shell ended by -e exits with the value of the command that failed, and a
+	// script with the value of its last command, as it would if that command had
+	// replaced the shell
+	return ERRABORT || SCRIPTED ? lastStatus() : 0;
+}
+
+
+/* Function that decides if a command read by the main loop can replace the shell
+ * rather than run as its child: it has to be the last command of a script or -c,
+ * a single foreground command, and nothing may be left for the shell to do after
+ * it, like background jobs to wait for or a journal, metrics, profile, recording
+ * or job statistics to write.
+ * Takes the Command struct about to run.
+ * Returns bool int of whether the command may replace the shell. */
+
+int canTailExec(struct Command *cmdInfo)
+{
+	int i;
+
+	if (SCRIPTED == 0 || cmdInfo->type != CMD_SIMPLE || cmdInfo->next != NULL
+		|| cmdInfo->isBgProcess == 1 || cmdInfo->argc == 0)
+	{
+		return 0;
+	}
+
+	if (journal.fd != -1 || metrics.path != NULL || profile.path != NULL
+		|| recorder.file != NULL || STATSPATH != NULL)
+	{
+		return 0;
+	}
+
+	for (i = 0; i < JOBCOUNT; i++)
+	{
+		if (JOBS[i].background == 1)
+		{
+			return 0;
+		}
+	}
+
+	return inputDone(&reader);
+}
+
+
+/* Function that gives Command struct default values.
+ * Takes Command struct allocated in memory. */
+
+void initCommand(struct Command *cmdInfo)
+{
+	cmdInfo->argCap = 16;
+	cmdInfo->argv = calloc(cmdInfo->argCap, sizeof(char *));
+	cmdInfo->argc = 0;
+	cmdInfo->isBgProcess = 0;
+	cmdInfo->wantsInputR = 0;
+	cmdInfo->wantsOutputR = 0;
+	cmdInfo->inRedirFile = NULL;
+	cmdInfo->outRedirFile = NULL;
+	cmdInfo->lineNo = 0;
+	cmdInfo->type = CMD_SIMPLE;
+	cmdInfo->cond = NULL;
+	cmdInfo->body = NULL;
+	cmdInfo->bodyCount = 0;
+	cmdInfo->arith = NULL;
+	cmdInfo->arithCount = 0;
+	cmdInfo->next = NULL;
+	cmdInfo->matcher = NULL;
+	cmdInfo->text = NULL;
+	cmdInfo->refs = 1;
+}
+
+
+/* Function that frees memory allocated Command struct, once nothing else holds it.
+ * Takes Command struct previously allocated. */
+
+void freeCommand(struct Command *garbage)
+{
+	int i;
+
+	if (garbage == NULL || --garbage->refs > 0)
+	{
+		return;
+	}
+
+	for (i = 0; i < garbage->argc; i++)
+	{
+		free(garbage->argv[i]);
+	}
+
+	for (i = 0; i < garbage->bodyCount; i++)
+	{
+		freeCommand(garbage->body[i]);
+	}
+
+	for (i = 0; i < garbage->arithCount; i++)
+	{
+		arithFree(garbage->arith[i].tree);
+		free(garbage->arith[i].text);
+	}
+
+	freeCommand(garbage->cond);
+	freeCommand(garbage->next);
+	matcherFree(garbage->matcher);
+	free(garbage->arith);
+	free(garbage->body);
+	free(garbage->argv);
+	free(garbage->inRedirFile);
+	free(garbage->outRedirFile);
+	free(garbage->text);
+	free(garbage);
+}
+
+
+/* Function that displays the user prompt, gets the user's input, parses out the
+ * commands, arguments, and symbols and fills a Command struct with all the
+ * pertinent information to be used when executing or running built-ins.
+ * Returns a filled Command struct that has been allocated in memory, or NULL
+ * once the input has been exhausted. */
+
+struct Command* getCommand()
+{
+	char *input;
+
+	// allocate memory for struct, freed later in main shell loop
+	struct Command *newCmd = malloc(sizeof(struct Command));
+
+	// set default values of struct
+	initCommand(newCmd);
+
+	// print the prompt along with any notices queued since the last one
+	showPrompt(": ");
+
+	// get user input, giving up at end of input
+	if ((input = readLine(&reader)) == NULL)
+	{
+		freeCommand(newCmd);
+		return NULL;
+	}
+
+	newCmd->lineNo = ++LINENO;
+
+	// a compound command reads the rest of itself, a broken one is dropped
+	if (parseCommand(input, newCmd) == -1 || parseCompound(newCmd) == -1)
+	{
+		freeCommand(newCmd);
+		newCmd = malloc(sizeof(struct Command));
+		initCommand(newCmd);
+		newCmd->lineNo = LINENO;
+		sprintf(ENDSTATE, "exit value 2");
+		metrics.parseErrors++;
+	}
+
+	return(newCmd);
+}
+
+
+/* Function that splits a command line into the commands, arguments, and symbols
+ * and fills the Command struct with the pertinent information. Quotes and
+ * backslashes are kept in the arguments, to be removed when they are expanded,
+ * and the delimiters and symbols they quote do not split the line. A '&' is the
+ * background flag only at the end of the line.
+ * Takes the line to parse, which is modified, and an initialized Command struct.
+ * Returns 0 on success or -1 after printing an error for a quote left open. */
+
+int parseCommand(char *line, struct Command *cmdInfo)
+{
+	struct Command *stage = cmdInfo;
+	char *token;
+	char *rest;
+	char *p = line;
+	char quote;
+	int comment = line[strspn(line, DELIM)] == '#';
+	char *end = line + strlen(line);
+	int wants = 0;
+	int depth;
+
+	// the session log keeps the line as it was typed
+	if (recorder.file != NULL && cmdInfo->text == NULL)
+	{
+		cmdInfo->text = strndup(line, strcspn(line, "\n"));
+	}
+
+	// continue getting token snippets until there are no more
+	while (1)
+	{
+		// skip the delimiters before the next snippet
+		while (p < end && (*p == ' ' || *p == '\t' || *p == '\n'))
+		{
+			p++;
+		}
+
+		if (p == end)
+		{
+			break;
+		}
+
+		// the snippet runs to the next delimiter, the scanner skips ordinary
+		// characters in bulk and only special ones are looked at here
+		// delimiters inside '$(' and its matching ')' do not end the snippet, and
+		// neither does anything quoted
+		token = p;
+		depth = 0;
+
+		while ((p = (char *)scanSpecial(p, end)) < end)
+		{
+			// nothing is quoted in a comment line
+			if (comment == 0 && (*p == '\'' || *p == '"' || *p == '\\'))
+			{
+				quote = *p;
+				p = (char *)skipQuoted(p);
+
+				if (*p == '\0')
+				{
+					fprintf(stderr, "unterminated %c quote\n", quote);
+					addArg(stage, strdup(token));
+					return -1;
+				}
+			}
+			else if (*p == '(' && (depth > 0 || (p > token && p[-1] == '$')))
+			{
+				depth++;
+			}
+			else if (*p == ')' && depth > 0)
+			{
+				depth--;
+			}
+			else if ((*p == ' ' || *p == '\t' || *p == '\n') && depth == 0)
+			{
+				break;
+			}
+
+			p++;
+		}
+
+		if (p < end)
+		{
+			*p++ = '\0';
+		}
+
+		// the snippet after a redirect symbol is the filename to be used later
+		// duplicate string into appropriate struct attribute
+		if (wants == '<')
+		{
+			stage->inRedirFile = strdup(token);
+			wants = 0;
+		}
+		else if (wants == '>')
+		{
+			stage->outRedirFile = strdup(token);
+			wants = 0;
+		}
+		// if snippet includes input redirect, set flag and expect the filename next
+		else if (strcmp(token, "<") == 0)
+		{
+			stage->wantsInputR = 1;
+			wants = '<';
+		}
+		// if snippet includes output redirect, same as input redirect
+		else if (strcmp(token, ">") == 0)
+		{
+			stage->wantsOutputR = 1;
+			wants = '>';
+		}
+		// if snippet is a background flag ending the line, set struct background
+		// flag, anywhere else it is an argument
+		else if (strcmp(token, "&") == 0)
+		{
+			for (rest = p; rest < end && (*rest == ' ' || *rest == '\t' || *rest == '\n'); rest++);
+
+			if (rest == end)
+			{
+				cmdInfo->isBgProcess = 1;
+			}
+			else
+			{
+				addArg(stage, strdup(token));
+			}
+		}
+		// if snippet is a pipe, the rest of the line is the next stage
+		else if (strcmp(token, "|") == 0)
+		{
+			stage->next = malloc(sizeof(struct Command));
+			initCommand(stage->next);
+			stage->next->lineNo = cmdInfo->lineNo;
+			stage = stage->next;
+			wants = 0;
+		}
+		// otherwise, add the argument to the arg array and increment count
+		else
+		{
+			addArg(stage, strdup(token));
+		}
+	}
+
+	// the background flag is for the whole pipeline
+	for (stage = cmdInfo->next; stage != NULL; stage = stage->next)
+	{
+		stage->isBgProcess = cmdInfo->isBgProcess;
+	}
+
+	return 0;
+}
+
+
+/* Function that finds the end of a quoted part of a word: the closing quote of a
+ * single quote, the closing quote of a double quote, in which a backslash quotes
+ * the next character, or the character after a backslash.
+ * Takes a pointer to the quote or backslash.
+ * Returns a pointer to the last character of the quoted part, or to the NUL if
+ * the quote is not closed. */
+
+const char* skipQuoted(const char *p)
+{
+	const char *end;
+
+	if (*p == '\'')
+	{
+		end = strchr(p + 1, '\'');
+		return end ? end : p + strlen(p);
+	}
+
+	if (*p == '"')
+	{
+		for (p++; *p != '\0' && *p != '"'; p++)
+		{
+			if (*p == '\\' && p[1] != '\0')
+			{
+				p++;
+			}
+		}
+
+		return p;
+	}
+
+	return *p == '\\' && p[1] != '\0' ? p + 1 : p;
+}
+
+
+/* Function that appends an argument to a Command struct, growing the argument
+ * array when needed and keeping it NULL terminated for exec.
+ * Takes the Command struct and the allocated argument string. */
+
+void addArg(struct Command *cmdInfo, char *arg)
+{
+	// keep room for the argument and the NULL after it
+	if (cmdInfo->argc + 2 > cmdInfo->argCap)
+	{
+		cmdInfo->argCap *= 2;
+		cmdInfo->argv = realloc(cmdInfo->argv, cmdInfo->argCap * sizeof(char *));
+	}
+
+	cmdInfo->argv[cmdInfo->argc++] = arg;
+	cmdInfo->argv[cmdInfo->argc] = NULL;
+}
+
+
+/* Function that hands out the next input line from a read-ahead buffer, reading
+ * another large block only once the buffered lines run out.
+ * Takes the reader to read from.
+ * Returns the line without its newline, valid until the next call, or NULL at
+ * the end of input. */
+
+char* readLine(struct Input *in)
+{
+	char *newline;
+	size_t len;
+
+	while (1)
+	{
+		// a complete line is already buffered
+		newline = memchr(in->buf + in->start, '\n', in->end - in->start);
+
+		if (newline != NULL)
+		{
+			*newline = '\0';
+			len = newline - (in->buf + in->start);
+			newline = in->buf + in->start;
+			in->start += len + 1;
+			return newline;
+		}
+
+		// last line without a newline
+		if (in->eof == 1)
+		{
+			if (in->start == in->end)
+			{
+				return NULL;
+			}
+
+			in->buf[in->end] = '\0';
+			newline = in->buf + in->start;
+			in->start = in->end;
+			return newline;
+		}
+
+		inputFill(in);
+	}
+}
+
+
+/* Function that reads another block into a reader, after moving the partial line
+ * left in it to the front. Lines handed out before are no longer valid.
+ * Takes the reader to fill. */
+
+void inputFill(struct Input *in)
+{
+	ssize_t len;
+
+	memmove(in->buf, in->buf + in->start, in->end - in->start);
+	in->end -= in->start;
+	in->start = 0;
+
+	if (in->cap - in->end < INPUT_BLOCK + 1)
+	{
+		in->cap = in->end + INPUT_BLOCK + 1;
+		in->buf = realloc(in->buf, in->cap);
+	}
+
+	do
+	{
+		len = read(in->fd, in->buf + in->end, in->cap - in->end - 1);
+	}while (len == -1 && errno == EINTR);
+
+	if (len <= 0)
+	{
+		in->eof = 1;
+	}
+	else
+	{
+		in->end += len;
+	}
+}
+
+
+/* Function that checks if a reader has nothing left but white space, reading
+ * ahead as far as it takes to know.
+ * Takes the reader to check.
+ * Returns bool int of whether the input is used up. */
+
+int inputDone(struct Input *in)
+{
+	size_t i;
+
+	while (1)
+	{
+		for (i = in->start; i < in->end; i++)
+		{
+			if (in->buf[i] != ' ' && in->buf[i] != '\t' && in->buf[i] != '\n')
+			{
+				return 0;
+			}
+		}
+
+		if (in->eof == 1)
+		{
+			return 1;
+		}
+
+		inputFill(in);
+	}
+}
+
+
+/* Function that hands buffered but unread input back to stdin before a child that
+ * might read it starts, so the child sees the offset a line at a time reader would
+ * have left. Input that cannot be seeked, like a pipe, stays with the shell. */
+
+void inputSync()
+{
+	struct Input *readers[2] = { &reader, &lineReader };
+	struct Input *in;
+	int i;
+
+	for (i = 0; i < 2; i++)
+	{
+		in = readers[i];
+
+		if (in->seekable == 0 || in->start == in->end)
+		{
+			continue;
+		}
+
+		if (lseek(0, -(off_t)(in->end - in->start), SEEK_CUR) != -1)
+		{
+			in->start = 0;
+			in->end = 0;
+			in->eof = 0;
+		}
+	}
+}
+
+
+/* Function that queues formatted text for stdout. Text that does not fit in the
+ * buffer causes an early flush, and text larger than the whole buffer is written
+ * straight away.
+ * Takes a printf style format and its arguments. */
+
+void outPrintf(const char *format, ...)
+{
+	va_list args;
+	char *big;
+	int len;
+
+	// make sure there is a free segment for the new text
+	if (output.count == OUTPUT_IOV)
+	{
+		outFlush();
+	}
+
+	va_start(args, format);
+	len = vsnprintf(output.buf + output.len, OUTPUT_SIZE - output.len, format, args);
+	va_end(args);
+
+	if (len < 0)
+	{
+		return;
+	}
+
+	// did not fit, make room and format it again
+	if ((size_t)len >= OUTPUT_SIZE - output.len)
+	{
+		outFlush();
+		va_start(args, format);
+
+		if (len < OUTPUT_SIZE)
+		{
+			vsnprintf(output.buf, OUTPUT_SIZE, format, args);
+			va_end(args);
+		}
+		else
+		{
+			big = malloc(len + 1);
+			vsnprintf(big, len + 1, format, args);
+			va_end(args);
+			outWrite(big, len);
+			outFlush();
+			free(big);
+			return;
+		}
+	}
+
+	// text that directly follows the previous segment joins it
+	if (output.count > 0 && (char *)output.iov[output.count - 1].iov_base
+		+ output.iov[output.count - 1].iov_len == output.buf + output.len)
+	{
+		output.iov[output.count - 1].iov_len += len;
+	}
+	else
+	{
+		output.iov[output.count].iov_base = output.buf + output.len;
+		output.iov[output.count].iov_len = len;
+		output.count++;
+	}
+
+	output.len += len;
+}
+
+
+/* Function that queues text for stdout without copying it, so it must stay valid
+ * until the next flush. Meant for string literals like the prompt.
+ * Takes the text and its length. */
+
+void outWrite(const char *text, size_t len)
+{
+	if (output.count == OUTPUT_IOV)
+	{
+		outFlush();
+	}
+
+	output.iov[output.count].iov_base = (char *)text;
+	output.iov[output.count].iov_len = len;
+	output.count++;
+}
+
+
+/* Function that writes everything queued for stdout with as few writev calls as
+ * the kernel allows, normally one. */
+
+void outFlush()
+{
+	struct iovec *iov = output.iov;
+	int count = output.count;
+	ssize_t wrote;
+
+	while (count > 0)
+	{
+		wrote = writev(1, iov, count);
+
+		if (wrote == -1)
+		{
+			if (errno == EINTR)
+			{
+				continue;
+			}
+
+			break;
+		}
+
+		// skip past whatever was written if the write came up short
+		while (count > 0 && (size_t)wrote >= iov->iov_len)
+		{
+			wrote -= iov->iov_len;
+			iov++;
+			count--;
+		}
+
+		if (count > 0)
+		{
+			iov->iov_base = (char *)iov->iov_base + wrote;
+			iov->iov_len -= wrote;
+		}
+	}
+
+	output.len = 0;
+	output.count = 0;
+}
+
+
+/* Function that fills the special character map and picks the fastest scanner
+ * the CPU supports. */
+
+void initScanner()
+{
+	const char *c;
+
+	for (c = DELIM SPECIAL; *c != '\0'; c++)
+	{
+		SPECIALMAP[(unsigned char)*c] = 1;
+	}
+
+#ifdef HAVE_SSE2
+	__builtin_cpu_init();
+
+	if (__builtin_cpu_supports("avx2"))
+	{
+		scanSpecial = scanAvx2;
+	}
+	else
+	{
+		scanSpecial = scanSse2;
+	}
+#endif
+}
+
+
+/* Function that finds the next delimiter or special character one byte at a time.
+ * Takes the start and end of the text to scan.
+ * Returns a pointer to the character found, or end if there is none. */
+
+const char* scanScalar(const char *p, const char *end)
+{
+	while (p < end && SPECIALMAP[(unsigned char)*p] == 0)
+	{
+		p++;
+	}
+
+	return p;
+}
+
+
+#ifdef HAVE_SSE2
+/* Function that finds the next delimiter or special character 16 bytes at a time
+ * by comparing each chunk against every character in DELIM and SPECIAL, with both
+ * parentheses caught by one compare since they differ only in the lowest bit.
+ * Takes the start and end of the text to scan.
+ * Returns a pointer to the character found, or end if there is none. */
+
+const char* scanSse2(const char *p, const char *end)
+{
+	const __m128i space = _mm_set1_epi8(' ');
+	const __m128i tab = _mm_set1_epi8('\t');
+	const __m128i newline = _mm_set1_epi8('\n');
+	const __m128i single = _mm_set1_epi8('\'');
+	const __m128i dbl = _mm_set1_epi8('"');
+	const __m128i less = _mm_set1_epi8('<');
+	const __m128i greater = _mm_set1_epi8('>');
+	const __m128i amp = _mm_set1_epi8('&');
+	const __m128i bar = _mm_set1_epi8('|');
+	const __m128i backslash = _mm_set1_epi8('\\');
+	const __m128i paren = _mm_set1_epi8('(');
+	const __m128i low = _mm_set1_epi8((char)0xfe);
+	__m128i chunk;
+	__m128i hits;
+	int mask;
+
+	while (end - p >= 16)
+	{
+		chunk = _mm_loadu_si128((const __m128i *)p);
+		hits = _mm_or_si128(
+			_mm_or_si128(
+				_mm_or_si128(_mm_cmpeq_epi8(chunk, space), _mm_cmpeq_epi8(chunk, tab)),
+				_mm_or_si128(_mm_cmpeq_epi8(chunk, newline), _mm_cmpeq_epi8(chunk, single))),
+			_mm_or_si128(
+				_mm_or_si128(_mm_cmpeq_epi8(chunk, dbl), _mm_cmpeq_epi8(chunk, less)),
+				_mm_or_si128(
+					_mm_or_si128(_mm_cmpeq_epi8(chunk, greater), _mm_cmpeq_epi8(chunk, amp)),
+					_mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(chunk, bar), _mm_cmpeq_epi8(chunk, backslash)),
+						_mm_cmpeq_epi8(_mm_and_si128(chunk, low), paren)))));
+		mask = _mm_movemask_epi8(hits);
+
+		if (mask != 0)
+		{
+			return p + __builtin_ctz(mask);
+		}
+
+		p += 16;
+	}
+
+	return scanScalar(p, end);
+}
+
+
+/* Function that finds the next delimiter or special character 32 bytes at a time,
+ * the same way as scanSse2 but with AVX2 registers.
+ * Takes the start and end of the text to scan.
+ * Returns a pointer to the character found, or end if there is none. */
+
+__attribute__((target("avx2")))
+const char* scanAvx2(const char *p, const char *end)
+{
+	const __m256i space = _mm256_set1_epi8(' ');
+	const __m256i tab = _mm256_set1_epi8('\t');
+	const __m256i newline = _mm256_set1_epi8('\n');
+	const __m256i single = _mm256_set1_epi8('\'');
+	const __m256i dbl = _mm256_set1_epi8('"');
+	const __m256i less = _mm256_set1_epi8('<');
+	const __m256i greater = _mm256_set1_epi8('>');
+	const __m256i amp = _mm256_set1_epi8('&');
+	const __m256i bar = _mm256_set1_epi8('|');
+	const __m256i backslash = _mm256_set1_epi8('\\');
+	const __m256i paren = _mm256_set1_epi8('(');
+	const __m256i low = _mm256_set1_epi8((char)0xfe);
+	__m256i chunk;
+	__m256i hits;
+	unsigned int mask;
+
+	while (end - p >= 32)
+	{
+		chunk = _mm256_loadu_si256((const __m256i *)p);
+		hits = _mm256_or_si256(
+			_mm256_or_si256(
+				_mm256_or_si256(_mm256_cmpeq_epi8(chunk, space), _mm256_cmpeq_epi8(chunk, tab)),
+				_mm256_or_si256(_mm256_cmpeq_epi8(chunk, newline), _mm256_cmpeq_epi8(chunk, single))),
+			_mm256_or_si256(
+				_mm256_or_si256(_mm256_cmpeq_epi8(chunk, dbl), _mm256_cmpeq_epi8(chunk, less)),
+				_mm256_or_si256(
+					_mm256_or_si256(_mm256_cmpeq_epi8(chunk, greater), _mm256_cmpeq_epi8(chunk, amp)),
+					_mm256_or_si256(_mm256_or_si256(_mm256_cmpeq_epi8(chunk, bar), _mm256_cmpeq_epi8(chunk, backslash)),
+						_mm256_cmpeq_epi8(_mm256_and_si256(chunk, low), paren)))));
+		mask = (unsigned int)_mm256_movemask_epi8(hits);
+
+		if (mask != 0)
+		{
+			return p + __builtin_ctz(mask);
+		}
+
+		p += 32;
+	}
+
+	return scanSse2(p, end);
+}
+#endif
+
+
+/* Function behind --bench-scan that times tokenizing a long generated command
+ * line with the scalar scanner and with the scanner picked for this CPU, and
+ * prints the throughput of each. */
+
+void benchScanner()
+{
+	const size_t size = 64 << 20;
+	const int rounds = 8;
+	const char *(*scanners[2])(const char *, const char *) = { scanScalar, scanSpecial };
+	const char *names[2] = { "scalar", "dispatched" };
+	char *line = malloc(size);
+	const char *p;
+	const char *end = line + size;
+	size_t len = 0;
+	long tokens;
+	int i;
+	int round;
+	struct timespec start;
+	struct timespec stop;
+
+	// a long file list like the ones generators produce
+	while (len + 64 < size)
+	{
+		len += sprintf(line + len, "build/objects/module_%06zu/source_file.o ", len);
+	}
+
+	memset(line + len, ' ', size - len);
+
+	for (i = 0; i < 2; i++)
+	{
+		clock_gettime(CLOCK_MONOTONIC, &start);
+		tokens = 0;
+
+		// count snippets the same way parseCommand finds them
+		for (round = 0; round < rounds; round++)
+		{
+			for (p = line; p < end; p++)
+			{
+				if (*p == ' ' || *p == '\t' || *p == '\n')
+				{
+					continue;
+				}
+
+				while ((p = scanners[i](p, end)) < end && *p != ' ' && *p != '\t' && *p != '\n')
+				{
+					p++;
+				}
+
+				tokens++;
+			}
+		}
+
+		clock_gettime(CLOCK_MONOTONIC, &stop);
+		printf("%-10s %ld tokens %.2f GB/s\n", names[i], tokens / rounds,
+			(double)size * rounds / timeDiff(&start, &stop) / 1e9);
+	}
+
+	free(line);
+}
+
+
+/* Function behind --bench-fork that times fork and exec of /bin/true, the way
+ * built-ins in a pipeline start, as the shell's resident set grows. Each size is
+ * timed with the memory on the heap, where fork copies its page tables, and in a
+ * cacheAlloc mapping, where it does not, next to posix_spawn for reference. */
+
+void benchFork()
+{
+	const size_t sizes[5] = { 0, 16, 64, 256, 1024 };
+	const int rounds = 200;
+	char *memory;
+	char *argv[2] = { "/bin/true", NULL };
+	struct timespec start;
+	struct timespec stop;
+	double secs[3];
+	size_t bytes;
+	pid_t pid;
+	int i;
+	int kind;
+	int round;
+
+	printf("%8s %14s %14s %14s\n", "RSS MB", "fork heap us", "fork cache us", "spawn us");
+
+	for (i = 0; i < 5; i++)
+	{
+		bytes = sizes[i] << 20;
+
+		for (kind = 0; kind < 3; kind++)
+		{
+			memory = bytes == 0 ? NULL : kind == 1 ? cacheAlloc(bytes) : malloc(bytes);
+
+			if (bytes != 0 && memory == NULL)
+			{
+				printf("%8zu cannot allocate\n", sizes[i]);
+				return;
+			}
+
+			// touch every page so it is resident
+			if (memory != NULL)
+			{
+				memset(memory, 1, bytes);
+			}
+
+			clock_gettime(CLOCK_MONOTONIC, &start);
+
+			for (round = 0; round < rounds; round++)
+			{
+				if (kind == 2)
+				{
+					posix_spawn(&pid, argv[0], NULL, NULL, argv, environ);
+				}
+				else if ((pid = fork()) == 0)
+				{
+					execv(argv[0], argv);
+					_exit(127);
+				}
+
+				waitpid(pid, NULL, 0);
+			}
+
+			clock_gettime(CLOCK_MONOTONIC, &stop);
+			secs[kind] = timeDiff(&start, &stop) / rounds;
+
+			if (kind == 1)
+			{
+				cacheFree(memory, bytes);
+			}
+			else
+			{
+				free(memory);
+			}
+		}
+
+		printf("%8zu %14.1f %14.1f %14.1f\n", sizes[i], secs[0] * 1e6, secs[1] * 1e6, secs[2] * 1e6);
+	}
+}
+
+
+/* Function that allocates zeroed memory for a shell cache in a mapping of its own,
+ * marked wipe on fork so a forked copy of the shell starts with it zeroed rather
+ * than having its page tables copied. Only caches that a forked copy can do
+ * without, or that read as empty when zeroed, belong here. Kernels before 4.14
+ * ignore the advice and copy the mapping like any other.
+ * Takes the size in bytes.
+ * Returns the memory, or NULL if it could not be mapped. */
+
+void* cacheAlloc(size_t size)
+{
+	void *cache = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+
+	if (cache == MAP_FAILED)
+	{
+		return NULL;
+	}
+
+	madvise(cache, size, MADV_WIPEONFORK);
+
+	return cache;
+}
+
+
+/* Function that gives back memory from cacheAlloc.
+ * Takes the memory, or NULL, and the size it was allocated with. */
+
+void cacheFree(void *cache, size_t size)
+{
+	if (cache != NULL)
+	{
+		munmap(cache, size);
+	}
+}
+
+
+/* Function to execute commands from the array inside the passed struct. First,
+ * handle blank lines, comments and definitions, then apply aliases and expand
+ * parameters, and run the result.
+ * Takes a filled Command struct with array containing arguments or commands,
+ * which is left unchanged so function bodies can be run again.
+ * Returns bool int of whether to continue shell loop or exiting. */
+
+int execCommand(struct Command *cmdInfo)
+{
+	struct Command *aliased;
+	struct Command *expanded;
+	int exitCalled;
+	int i;
+
+	// merge samples taken so far, long loops never get back to the prompt
+	if (profile.head != profile.tail)
+	{
+		profileDrain();
+	}
+
+	// a command run from a function or loop body has a line of its own
+	LINETEXT = cmdInfo->text;
+
+	// if blank line, return 0 to continue shell loop
+	if (cmdInfo->argv[0] == NULL || cmdInfo->argc == 0)
+	{
+		return 0;
+	}
+	// if a comment, return 0 to continue shell loop
+	else if (strncmp(cmdInfo->argv[0], "#", 1) == 0)
+	{
+		return 0;
+	}
+	// if a while loop, run it
+	else if (cmdInfo->type == CMD_WHILE)
+	{
+		return runWhile(cmdInfo);
+	}
+	// if a case statement, run the branch that matches
+	else if (cmdInfo->type == CMD_CASE)
+	{
+		return runCase(cmdInfo);
+	}
+	// if a function definition, store it under its name
+	else if (cmdInfo->type == CMD_FUNCTION)
+	{
+		struct Name *name = insertName(cmdInfo->argv[0]);
+		struct Command *function = malloc(sizeof(struct Command));
+
+		// the stored copy takes over the parsed body
+		initCommand(function);
+		addArg(function, strdup(cmdInfo->argv[0]));
+		function->type = CMD_FUNCTION;
+		function->body = cmdInfo->body;
+		function->bodyCount = cmdInfo->bodyCount;
+		cmdInfo->body = NULL;
+		cmdInfo->bodyCount = 0;
+
+		freeCommand(name->function);
+		name->function = function;
+		sprintf(ENDSTATE, "exit value 0");
+		return 0;
+	}
+	// if a pipeline, run all of its stages together
+	else if (cmdInfo->next != NULL)
+	{
+		metrics.commands++;
+		return runPipeline(cmdInfo) == 1 ? 1 : errExit();
+	}
+
+	metrics.commands++;
+
+	// if every word is an assignment, set the variables
+	for (i = 0; i < cmdInfo->argc && isAssignment(cmdInfo->argv[i]); i++);
+
+	if (i == cmdInfo->argc)
+	{
+		sprintf(ENDSTATE, "exit value 0");
+
+		for (i = 0; i < cmdInfo->argc; i++)
+		{
+			char *equals = strchr(cmdInfo->argv[i], '=');
+			char *value = expandText(cmdInfo, equals + 1, NULL);
+
+			if (value == NULL)
+			{
+				sprintf(ENDSTATE, "exit value 1");
+				return errExit();
+			}
+
+			*equals = '\0';
+			setVar(cmdInfo->argv[i], value);
+			*equals = '=';
+			free(value);
+		}
+
+		return 0;
+	}
+
+	aliased = applyAlias(cmdInfo);
+	expanded = expandCommand(aliased ? aliased : cmdInfo);
+	freeCommand(aliased);
+
+	// a failed expansion has already said why
+	if (expanded == NULL)
+	{
+		sprintf(ENDSTATE, "exit value 1");
+		return errExit();
+	}
+
+	exitCalled = runCommand(expanded);
+	freeCommand(expanded);
+
+	return exitCalled == 1 ? 1 : errExit();
+}
+
+
+/* Function that runs an expanded command. The name table is checked once to find
+ * a function or built-in, or else a child process is started and handled with
+ * background/foreground and child/parent logic.
+ * Takes an expanded Command struct.
+ * Returns bool int of whether to continue shell loop or exiting. */
+
+int runCommand(struct Command *cmdInfo)
+{
+	// process id for non built-in command use
+	pid_t pid;
+	struct Name *name;
+	struct Frame frame;
+	struct timespec began;
+	int exitCalled;
+	int tail = TAILEXEC;
+
+	// only the command the main loop marked may replace the shell, not any
+	// command a function or built-in runs for it
+	TAILEXEC = 0;
+
+	// expansion can leave nothing to run
+	if (cmdInfo->argc == 0)
+	{
+		return 0;
+	}
+
+	// functions come before built-ins so a function can stand in for one
+	name = lookupName(cmdInfo->argv[0]);
+
+	// exec keeps its redirections, for every other built-in and function they
+	// apply to the shell only while it runs, so nothing needs to fork for them
+	if (name != NULL && name->builtin == builtinExec)
+	{
+		return builtinExec(cmdInfo);
+	}
+	else if (name != NULL && (name->function != NULL || name->builtin != NULL))
+	{
+		if (pushFrame(cmdInfo, &frame) == -1)
+		{
+			sprintf(ENDSTATE, "exit value 1");
+			return errExit();
+		}
+
+		if (name->function != NULL)
+		{
+			exitCalled = callFunction(name->function, cmdInfo);
+		}
+		else
+		{
+			exitCalled = name->builtin(cmdInfo);
+		}
+
+		popFrame(&frame);
+		return exitCalled;
+	}
+
+	// the last command of a script becomes the shell instead of its child
+	if (tail == 1 && cmdInfo->isBgProcess == 0)
+	{
+		return execReplace(cmdInfo);
+	}
+
+	// otherwise, the command was not a built-in
+	// start the command as a child process
+	clock_gettime(CLOCK_MONOTONIC, &began);
+	pid = spawnCommand(cmdInfo, -1, -1);
+
+	// if the child could not be started, a foreground command failed
+	if (pid == -1)
+	{
+		if (cmdInfo->isBgProcess == 0)
+		{
+			sprintf(ENDSTATE, "exit value 1");
+		}
+	}
+	// if it is a foreground process wait for the child to terminate
+	else if (cmdInfo->isBgProcess == 0)
+	{
+		waitForeground(pid);
+	}
+	// if it is a background process, just print the pid
+	else
+	{
+		outPrintf("background pid is %d\n", pid);
+	}
+
+	recordCommand(&cmdInfo, 1, &began);
+
+	// return 0 to continue the shell loop
+	return 0;
+}
+
+
+/* Function that expands the stages of a pipeline and runs them.
+ * Takes the first stage of a parsed pipeline, which is left unchanged.
+ * Returns bool int of whether to continue shell loop or exiting. */
+
+int runPipeline(struct Command *raw)
+{
+	struct Command *stages[MAX_CMD_ARGS];
+	struct Command *stage;
+	struct Command *aliased;
+	int count = 0;
+	int exitCalled = 0;
+
+	// expand every stage before any of them start
+	for (stage = raw; stage != NULL; stage = stage->next)
+	{
+		if (stage->argc == 0 || count == MAX_CMD_ARGS)
+		{
+			fprintf(stderr, "syntax error near '|'\n");
+			sprintf(ENDSTATE, "exit value 2");
+			metrics.parseErrors++;
+			break;
+		}
+
+		aliased = applyAlias(stage);
+		stages[count] = expandCommand(aliased ? aliased : stage);
+		freeCommand(aliased);
+
+		// a failed expansion has already said why
+		if (stages[count] == NULL)
+		{
+			sprintf(ENDSTATE, "exit value 1");
+			break;
+		}
+
+		count++;
+	}
+
+	if (stage == NULL)
+	{
+		exitCalled = runStages(stages, count);
+	}
+
+	while (count > 0)
+	{
+		freeCommand(stages[--count]);
+	}
+
+	return exitCalled;
+}
+
+
+/* Function that runs the expanded stages of a pipeline with the stdout of each
+ * stage connected to the stdin of the next. Built-ins and functions in a pipeline
+ * run in a forked copy of the shell. The pipeline's value is that of its last
+ * stage, or with pipefail that of the last stage that failed. With -e the first
+ * stage to fail has the rest of the pipeline killed right away rather than left
+ * to run to the end.
+ * Takes the expanded stages and their count.
+ * Returns bool int of whether to continue shell loop or exiting. */
+
+int runStages(struct Command **stages, int count)
+{
+	struct Name *name;
+	struct rusage usage;
+	struct timespec start;
+	struct timespec began;
+	pid_t pids[MAX_CMD_ARGS] = {0};
+	int statuses[MAX_CMD_ARGS] = {0};
+	int fds[2];
+	int inPipe = -1;
+	int running = 0;
+	int status;
+	int last;
+	pid_t pid;
+	int i;
+
+	clock_gettime(CLOCK_MONOTONIC, &began);
+
+	for (i = 0; i < count; i++)
+	{
+		pids[i] = -1;
+		statuses[i] = 1 << 8;
+	}
+
+	for (i = 0; i < count; i++)
+	{
+		fds[0] = -1;
+		fds[1] = -1;
+
+		// the shell's copies of the pipe ends are kept out of every child
+		if (i < count - 1)
+		{
+			if (pipe(fds) == -1)
+			{
+				fprintf(stderr, "cannot create pipe\n");
+				break;
+			}
+
+			fcntl(fds[0], F_SETFD, FD_CLOEXEC);
+			fcntl(fds[1], F_SETFD, FD_CLOEXEC);
+		}
+
+		name = stages[i]->argc > 0 ? lookupName(stages[i]->argv[0]) : NULL;
+
+		if (name == NULL || (name->function == NULL && name->builtin == NULL))
+		{
+			if (stages[i]->argc > 0)
+			{
+				pids[i] = spawnCommand(stages[i], inPipe, fds[1]);
+			}
+		}
+		else
+		{
+			// a built-in or function gets a copy of the shell with the pipe ends
+			// as stdin and stdout, then its own redirections on top
+			outFlush();
+			inputSync();
+			clock_gettime(CLOCK_MONOTONIC, &start);
+			pids[i] = fork();
+
+			if (pids[i] == 0)
+			{
+				SUBSHELL = 1;
+
+				if (stages[i]->isBgProcess == 0)
+				{
+					action.sa_handler = SIG_DFL;
+					sigaction(SIGINT, &action, NULL);
+				}
+
+				if (inPipe != -1)
+				{
+					dup2(inPipe, 0);
+					close(inPipe);
+					memset(&lineReader, 0, sizeof lineReader);
+					reader.seekable = 0;
+					STDINFRAMES++;
+				}
+
+				if (fds[1] != -1)
+				{
+					dup2(fds[1], 1);
+					close(fds[1]);
+					close(fds[0]);
+				}
+
+				// redirections on top of the pipe are applied by runCommand
+				runCommand(stages[i]);
+				outFlush();
+				_exit(lastStatus());
+			}
+
+			if (pids[i] > 0)
+			{
+				startJob(pids[i], stages[i], &start);
+			}
+		}
+
+		if (inPipe != -1)
+		{
+			close(inPipe);
+		}
+
+		if (fds[1] != -1)
+		{
+			close(fds[1]);
+		}
+
+		inPipe = fds[0];
+		running += pids[i] > 0;
+	}
+
+	if (inPipe != -1)
+	{
+		close(inPipe);
+	}
+
+	// a background pipeline is known by its last stage
+	if (stages[0]->isBgProcess == 1)
+	{
+		if (pids[count - 1] > 0)
+		{
+			outPrintf("background pid is %d\n", pids[count - 1]);
+		}
+
+		running = 0;
+	}
+
+	// wait for every stage, reporting background children that end meanwhile
+	while (running > 0 && (pid = waitChild(-1, &status, &usage)) > 0)
+	{
+		endJob(pid, status, &usage);
+
+		for (i = 0; i < count && pids[i] != pid; i++);
+
+		if (i == count)
+		{
+			reportBgExit(pid, status);
+			continue;
+		}
+
+		statuses[i] = status;
+		pids[i] = -1;
+		running--;
+
+		// under -e a failed stage takes the rest down with it, though one ended by
+		// SIGPIPE only lost its reader
+		if (ERREXIT == 1 && CONDDEPTH == 0 && status != 0
+			&& !(WIFSIGNALED(status) && WTERMSIG(status) == SIGPIPE))
+		{
+			for (i = 0; i < count; i++)
+			{
+				if (pids[i] > 0)
+				{
+					kill(pids[i], SIGTERM);
+				}
+			}
+		}
+	}
+
+	if (stages[0]->isBgProcess == 0)
+	{
+		last = count - 1;
+
+		for (i = count - 1; PIPEFAIL == 1 && i >= 0; i--)
+		{
+			if (statuses[i] != 0)
+			{
+				last = i;
+				break;
+			}
+		}
+
+		recordStatus(statuses[last]);
+	}
+
+	recordCommand(stages, count, &began);
+
+	return 0;
+}
+
+
+/* Function that checks if -e should end the shell after a command, which it does
+ * once a command fails anywhere but in a while condition.
+ * Returns bool int of whether to continue shell loop or exiting. */
+
+int errExit()
+{
+	if (ERREXIT == 0 || CONDDEPTH > 0 || lastStatus() == 0)
+	{
+		return 0;
+	}
+
+	ERRABORT = 1;
+
+	return 1;
+}
+
+
+/* Function that recognizes the first line of a compound command and reads the
+ * rest of it. A function definition is 'name() {' or 'function name {' followed by
+ * its commands, one per line, and a closing '}' line. A loop is 'while command'
+ * followed by a 'do' line, or 'while command; do', then its commands and a closing
+ * 'done' line, which may redirect the input or output of the whole loop.
+ * Takes a Command struct parsed from a single line.
+ * Returns 0 on success or -1 after printing an error. */
+
+int parseCompound(struct Command *cmdInfo)
+{
+	struct Command *cond;
+	char *name = NULL;
+	size_t len;
+	int words = 0;
+	int i;
+
+	if (cmdInfo->argc == 0)
+	{
+		return 0;
+	}
+
+	if (strcmp(cmdInfo->argv[0], "case") == 0)
+	{
+		if (cmdInfo->argc != 3 || strcmp(cmdInfo->argv[2], "in") != 0)
+		{
+			fprintf(stderr, "case: expected 'case word in'\n");
+			return -1;
+		}
+
+		cmdInfo->type = CMD_CASE;
+		return readCase(cmdInfo);
+	}
+
+	if (strcmp(cmdInfo->argv[0], "while") == 0)
+	{
+		// the rest of the line, redirections included, is the condition
+		cond = malloc(sizeof(struct Command));
+		*cond = *cmdInfo;
+		initCommand(cmdInfo);
+		cmdInfo->lineNo = cond->lineNo;
+		cmdInfo->type = CMD_WHILE;
+		cmdInfo->cond = cond;
+		addArg(cmdInfo, strdup("while"));
+
+		free(cond->argv[0]);
+		memmove(cond->argv, cond->argv + 1, cond->argc * sizeof(char *));
+		cond->argc--;
+
+		// '; do' at the end of the line opens the body right away
+		i = cond->argc - 1;
+
+		if (i >= 1 && strcmp(cond->argv[i], "do") == 0 && cond->argv[i - 1][strlen(cond->argv[i - 1]) - 1] == ';')
+		{
+			free(cond->argv[i]);
+			cond->argv[i] = NULL;
+			cond->argc--;
+			i--;
+
+			// the ';' may be a word of its own or end the previous one
+			if (strcmp(cond->argv[i], ";") == 0)
+			{
+				free(cond->argv[i]);
+				cond->argv[i] = NULL;
+				cond->argc--;
+			}
+			else
+			{
+				cond->argv[i][strlen(cond->argv[i]) - 1] = '\0';
+			}
+		}
+		else if (readBody(cmdInfo, "do") == -1)
+		{
+			return -1;
+		}
+		else if (cmdInfo->bodyCount > 0)
+		{
+			fprintf(stderr, "while: expected 'do'\n");
+			return -1;
+		}
+
+		if (cond->argc == 0)
+		{
+			fprintf(stderr, "while: missing condition\n");
+			return -1;
+		}
+
+		return readBody(cmdInfo, "done");
+	}
+
+	len = strlen(cmdInfo->argv[0]);
+
+	// 'name() {', 'name () {' and 'function name {'
+	if (len > 2 && strcmp(cmdInfo->argv[0] + len - 2, "()") == 0)
+	{
+		cmdInfo->argv[0][len - 2] = '\0';
+		name = cmdInfo->argv[0];
+		words = 1;
+	}
+	else if (cmdInfo->argc > 1 && strcmp(cmdInfo->argv[1], "()") == 0)
+	{
+		name = cmdInfo->argv[0];
+		words = 2;
+	}
+	else if (strcmp(cmdInfo->argv[0], "function") == 0 && cmdInfo->argc > 1)
+	{
+		name = cmdInfo->argv[1];
+		words = 2;
+	}
+
+	if (name == NULL)
+	{
+		return 0;
+	}
+
+	if (cmdInfo->argc != words + 1 || strcmp(cmdInfo->argv[words], "{") != 0)
+	{
+		fprintf(stderr, "%s: expected '{' to end the line\n", name);
+		return -1;
+	}
+
+	// keep only the name in argv
+	name = strdup(name);
+
+	while (cmdInfo->argc > 0)
+	{
+		free(cmdInfo->argv[--cmdInfo->argc]);
+	}
+
+	addArg(cmdInfo, name);
+	cmdInfo->type = CMD_FUNCTION;
+
+	return readBody(cmdInfo, "}");
+}
+
+
+/* Function that reads the lines of a compound command's body, each parsed once
+ * and kept for every later run, up to the line holding just the terminator.
+ * Redirections on the terminating line are kept for the whole compound command.
+ * Takes the compound Command struct and the terminating word.
+ * Returns 0 on success or -1 after printing an error. */
+
+int readBody(struct Command *cmdInfo, const char *terminator)
+{
+	struct Command *line;
+	char *input;
+
+	while (1)
+	{
+		// continuation lines get their own prompt
+		showPrompt("> ");
+
+		if ((input = readLine(&reader)) == NULL)
+		{
+			fprintf(stderr, "unexpected end of input, expected '%s'\n", terminator);
+			return -1;
+		}
+
+		line = malloc(sizeof(struct Command));
+		initCommand(line);
+		line->lineNo = ++LINENO;
+
+		if (parseCommand(input, line) == -1)
+		{
+			freeCommand(line);
+			return -1;
+		}
+
+		if (line->argc == 1 && strcmp(line->argv[0], terminator) == 0)
+		{
+			cmdInfo->wantsInputR = line->wantsInputR;
+			cmdInfo->wantsOutputR = line->wantsOutputR;
+			cmdInfo->inRedirFile = line->inRedirFile;
+			cmdInfo->outRedirFile = line->outRedirFile;
+			line->inRedirFile = NULL;
+			line->outRedirFile = NULL;
+			freeCommand(line);
+			return 0;
+		}
+
+		if (line->argc == 0 || line->argv[0][0] == '#')
+		{
+			freeCommand(line);
+			continue;
+		}
+
+		if (parseCompound(line) == -1)
+		{
+			freeCommand(line);
+			return -1;
+		}
+
+		cmdInfo->body = realloc(cmdInfo->body, (cmdInfo->bodyCount + 1) * sizeof(struct Command *));
+		cmdInfo->body[cmdInfo->bodyCount++] = line;
+	}
+}
+
+
+/* Function that reads the branches of a case statement up to the 'esac' line.
+ * A branch starts with a line whose first word is its patterns separated by '|'
+ * and ending in ')', which may be followed by a command, and runs to a ';;' that
+ * is a line of its own or the last word of a command line.
+ * Takes the case Command struct, whose body gets a Command struct per branch with
+ * the patterns as its arguments and the branch's commands as its body.
+ * Returns 0 on success or -1 after printing an error. */
+
+int readCase(struct Command *cmdInfo)
+{
+	struct Command *line;
+	struct Command *branch = NULL;
+	char *input;
+	char *word;
+	char *bar;
+	size_t len;
+	int ends;
+
+	while (1)
+	{
+		showPrompt("> ");
+
+		if ((input = readLine(&reader)) == NULL)
+		{
+			fprintf(stderr, "unexpected end of input, expected 'esac'\n");
+			return -1;
+		}
+
+		line = malloc(sizeof(struct Command));
+		initCommand(line);
+		line->lineNo = ++LINENO;
+
+		if (parseCommand(input, line) == -1)
+		{
+			freeCommand(line);
+			return -1;
+		}
+
+		if (line->argc == 1 && line->next == NULL && strcmp(line->argv[0], "esac") == 0)
+		{
+			cmdInfo->wantsInputR = line->wantsInputR;
+			cmdInfo->wantsOutputR = line->wantsOutputR;
+			cmdInfo->inRedirFile = line->inRedirFile;
+			cmdInfo->outRedirFile = line->outRedirFile;
+			line->inRedirFile = NULL;
+			line->outRedirFile = NULL;
+			freeCommand(line);
+			return 0;
+		}
+
+		if (line->argc == 0 || line->argv[0][0] == '#')
+		{
+			freeCommand(line);
+			continue;
+		}
+
+		// outside a branch the line must start with the next branch's patterns
+		if (branch == NULL)
+		{
+			word = line->argv[0];
+			len = strlen(word);
+
+			if (len < 2 || word[len - 1] != ')')
+			{
+				fprintf(stderr, "case: expected a pattern ending in ')'\n");
+				freeCommand(line);
+				return -1;
+			}
+
+			word[len - 1] = '\0';
+			word += word[0] == '(';
+			branch = malloc(sizeof(struct Command));
+			initCommand(branch);
+			branch->lineNo = line->lineNo;
+
+			// patterns are split on every '|' that is not quoted
+			for (bar = word; *bar != '\0'; bar++)
+			{
+				if (*bar == '\'' || *bar == '"' || *bar == '\\')
+				{
+					bar = (char *)skipQuoted(bar);
+				}
+				else if (*bar == '|')
+				{
+					addArg(branch, strndup(word, bar - word));
+					word = bar + 1;
+				}
+			}
+
+			addArg(branch, strdup(word));
+			cmdInfo->body = realloc(cmdInfo->body, (cmdInfo->bodyCount + 1) * sizeof(struct Command *));
+			cmdInfo->body[cmdInfo->bodyCount++] = branch;
+
+			// what follows the patterns is the branch's first command
+			free(line->argv[0]);
+			memmove(line->argv, line->argv + 1, line->argc * sizeof(char *));
+			line->argc--;
+		}
+
+		// a trailing ';;' ends the branch after this line
+		ends = 0;
+
+		if (line->argc > 0)
+		{
+			word = line->argv[line->argc - 1];
+			len = strlen(word);
+
+			if (len >= 2 && strcmp(word + len - 2, ";;") == 0)
+			{
+				ends = 1;
+				word[len - 2] = '\0';
+
+				if (len == 2)
+				{
+					free(word);
+					line->argv[--line->argc] = NULL;
+				}
+			}
+		}
+
+		if (line->argc == 0)
+		{
+			freeCommand(line);
+		}
+		else if (parseCompound(line) == -1)
+		{
+			freeCommand(line);
+			return -1;
+		}
+		else
+		{
+			branch->body = realloc(branch->body, (branch->bodyCount + 1) * sizeof(struct Command *));
+			branch->body[branch->bodyCount++] = line;
+		}
+
+		if (ends == 1)
+		{
+			branch = NULL;
+		}
+	}
+}
+
+
+/* Function that runs a case statement: the word is expanded and the commands of
+ * the first branch with a matching pattern are run. Patterns are compiled once
+ * and kept with the statement unless they hold something to expand, in which case
+ * they are expanded and compiled on every run.
+ * Takes the case Command struct.
+ * Returns bool int of whether to continue shell loop or exiting. */
+
+int runCase(struct Command *cmdInfo)
+{
+	struct Matcher *matcher = cmdInfo->matcher;
+	struct Command *branch;
+	struct Frame frame;
+	char **texts = NULL;
+	int *branches = NULL;
+	char *word;
+	char *text;
+	char *mask;
+	int count = 0;
+	int dynamic = 0;
+	int exitCalled = 0;
+	int found;
+	int i;
+	int j;
+
+	word = expandText(cmdInfo, cmdInfo->argv[1], NULL);
+
+	if (word == NULL)
+	{
+		sprintf(ENDSTATE, "exit value 1");
+		return errExit();
+	}
+
+	if (matcher == NULL)
+	{
+		for (i = 0; i < cmdInfo->bodyCount; i++)
+		{
+			branch = cmdInfo->body[i];
+			texts = realloc(texts, (count + branch->argc) * sizeof(char *));
+			branches = realloc(branches, (count + branch->argc) * sizeof(int));
+
+			for (j = 0; j < branch->argc; j++, count++)
+			{
+				dynamic |= strchr(branch->argv[j], '$') != NULL;
+				// quoted wildcards in a pattern match themselves
+				mask = NULL;
+				text = expandText(branch, branch->argv[j], &mask);
+				texts[count] = text ? globEscape(text, mask) : strdup("");
+				branches[count] = i;
+				free(text);
+				free(mask);
+			}
+		}
+
+		matcher = matcherCompile(texts, branches, count);
+
+		for (i = 0; i < count; i++)
+		{
+			free(texts[i]);
+		}
+
+		free(texts);
+		free(branches);
+
+		if (dynamic == 0)
+		{
+			cmdInfo->matcher = matcher;
+		}
+	}
+
+	found = matcherFind(matcher, word);
+	free(word);
+
+	if (dynamic == 1)
+	{
+		matcherFree(matcher);
+	}
+
+	sprintf(ENDSTATE, "exit value 0");
+
+	if (found == -1)
+	{
+		return 0;
+	}
+
+	if (pushFrame(cmdInfo, &frame) == -1)
+	{
+		sprintf(ENDSTATE, "exit value 1");
+		return errExit();
+	}
+
+	branch = cmdInfo->body[found];
+
+	for (i = 0; i < branch->bodyCount && exitCalled == 0; i++)
+	{
+		exitCalled = execCommand(branch->body[i]);
+
+		if (BREAKING == 1 || CONTINUING == 1 || RETURNING == 1)
+		{
+			break;
+		}
+	}
+
+	popFrame(&frame);
+
+	return exitCalled;
+}
+
+
+/* Function that compiles a list of patterns into a matcher that finds the first
+ * one matching a word. Each pattern gets a bit in byte tables indexed by a word's
+ * first and last byte, so one lookup in each rules out every pattern that cannot
+ * match, however many there are.
+ * Takes the patterns, the case branch each belongs to and their count.
+ * Returns the matcher in newly allocated memory. */
+
+struct Matcher* matcherCompile(char **texts, int *branches, int count)
+{
+	struct Matcher *matcher = calloc(1, sizeof(struct Matcher));
+	struct PatternOp *op;
+	uint64_t bit;
+	int i;
+	int b;
+	int k;
+
+	matcher->count = count;
+	matcher->words = (count + 63) / 64;
+	matcher->patterns = calloc(count ? count : 1, sizeof(struct Pattern));
+	matcher->first = calloc(256 * matcher->words + 1, sizeof(uint64_t));
+	matcher->last = calloc(256 * matcher->words + 1, sizeof(uint64_t));
+	matcher->empty = calloc(matcher->words + 1, sizeof(uint64_t));
+
+	for (i = 0; i < count; i++)
+	{
+		patternCompile(matcher, texts[i], &matcher->patterns[i]);
+		matcher->patterns[i].branch = branches[i];
+		bit = 1ULL << (i % 64);
+
+		if (matcher->patterns[i].minLen == 0)
+		{
+			matcher->empty[i / 64] |= bit;
+		}
+
+		// the first step decides the first byte and the last step the last byte
+		for (k = 0; k < 2 && matcher->patterns[i].count > 0; k++)
+		{
+			op = &matcher->patterns[i].ops[k == 0 ? 0 : matcher->patterns[i].count - 1];
+
+			for (b = 0; b < 256; b++)
+			{
+				if (op->type == PAT_STAR || op->type == PAT_ANY || (op->type == PAT_CHAR && op->c == b)
+					|| (op->type == PAT_SET && (matcher->sets[op->set][b >> 3] >> (b & 7) & 1)))
+				{
+					(k == 0 ? matcher->first : matcher->last)[b * matcher->words + i / 64] |= bit;
+				}
+			}
+		}
+	}
+
+	return matcher;
+}
+
+
+/* Function that compiles one glob pattern: '*' matches any run of bytes, '?' any
+ * one byte, '[...]' one byte from a set, with '!' or '^' first for the bytes not
+ * in it and ranges like 'a-z', and a backslash makes the next byte literal.
+ * Takes the matcher, which owns the byte sets, the pattern and the Pattern struct
+ * to fill. */
+
+void patternCompile(struct Matcher *matcher, const char *text, struct Pattern *pattern)
+{
+	struct PatternOp *op;
+	unsigned char *set;
+	const char *p = text;
+	const char *close;
+	int negate;
+	int c;
+
+	pattern->ops = malloc((strlen(text) + 1) * sizeof(struct PatternOp));
+	pattern->prefix = malloc(strlen(text) + 1);
+
+	while (*p != '\0')
+	{
+		op = &pattern->ops[pattern->count];
+		op->type = PAT_CHAR;
+		op->c = (unsigned char)*p;
+
+		// a bracket expression needs its closing bracket, else it is literal
+		close = *p == '[' ? strchr(p + 1 + (p[1] == '!' || p[1] == '^') + 1, ']') : NULL;
+
+		if (*p == '*')
+		{
+			// runs of stars are one star
+			if (pattern->count > 0 && op[-1].type == PAT_STAR)
+			{
+				p++;
+				continue;
+			}
+
+			op->type = PAT_STAR;
+			pattern->hasStar = 1;
+		}
+		else if (*p == '?')
+		{
+			op->type = PAT_ANY;
+		}
+		else if (close != NULL)
+		{
+			matcher->sets = realloc(matcher->sets, (matcher->setCount + 1) * sizeof(*matcher->sets));
+			set = matcher->sets[matcher->setCount];
+			memset(set, 0, 32);
+			op->type = PAT_SET;
+			op->set = matcher->setCount++;
+			negate = p[1] == '!' || p[1] == '^';
+
+			for (p += 1 + negate; p < close; p++)
+			{
+				if (p[1] == '-' && p + 2 < close)
+				{
+					for (c = (unsigned char)p[0]; c <= (unsigned char)p[2]; c++)
+					{
+						set[c >> 3] |= 1 << (c & 7);
+					}
+
+					p += 2;
+				}
+				else
+				{
+					set[(unsigned char)*p >> 3] |= 1 << ((unsigned char)*p & 7);
+				}
+			}
+
+			for (c = 0; negate == 1 && c < 32; c++)
+			{
+				set[c] = ~set[c];
+			}
+
+			p = close;
+		}
+		else if (*p == '\\' && p[1] != '\0')
+		{
+			op->c = (unsigned char)*++p;
+		}
+
+		// the literal prefix runs up to the first wildcard
+		if (op->type == PAT_CHAR && pattern->prefixLen == pattern->count)
+		{
+			pattern->prefix[pattern->prefixLen++] = op->c;
+		}
+
+		pattern->minLen += op->type != PAT_STAR;
+		pattern->count++;
+		p++;
+	}
+}
+
+
+/* Function that finds the first pattern in a matcher that matches a whole word.
+ * Takes the matcher and the word.
+ * Returns the case branch of the pattern, or -1 if none matches. */
+
+int matcherFind(struct Matcher *matcher, const char *word)
+{
+	struct Pattern *pattern;
+	const uint64_t *first;
+	const uint64_t *last;
+	uint64_t candidates;
+	int len = strlen(word);
+	int w;
+	int i;
+
+	first = matcher->first + (unsigned char)word[0] * matcher->words;
+	last = matcher->last + (unsigned char)word[len ? len - 1 : 0] * matcher->words;
+
+	for (w = 0; w < matcher->words; w++)
+	{
+		candidates = len == 0 ? matcher->empty[w] : first[w] & last[w];
+
+		// patterns are tried in order, lowest bit first
+		while (candidates != 0)
+		{
+			i = w * 64 + __builtin_ctzll(candidates);
+			candidates &= candidates - 1;
+			pattern = &matcher->patterns[i];
+
+			if (len < pattern->minLen || (pattern->hasStar == 0 && len != pattern->minLen)
+				|| memcmp(word, pattern->prefix, pattern->prefixLen) != 0)
+			{
+				continue;
+			}
+
+			if (patternMatch(matcher, pattern, word, len))
+			{
+				return pattern->branch;
+			}
+		}
+	}
+
+	return -1;
+}
+
+
+/* Function that matches a whole word against a compiled pattern, going back to
+ * the last star on a mismatch, which keeps it linear for the usual patterns.
+ * Takes the matcher that owns the byte sets, the pattern and the word and its
+ * length.
+ * Returns bool int of whether the pattern matches. */
+
+int patternMatch(struct Matcher *matcher, struct Pattern *pattern, const char *word, int len)
+{
+	struct PatternOp *ops = pattern->ops;
+	unsigned char c;
+	int pi = 0;
+	int wi = 0;
+	int starPi = -1;
+	int starWi = 0;
+
+	while (wi < len)
+	{
+		c = (unsigned char)word[wi];
+
+		if (pi < pattern->count && ops[pi].type == PAT_STAR)
+		{
+			starPi = pi++;
+			starWi = wi;
+			continue;
+		}
+
+		if (pi < pattern->count && (ops[pi].type == PAT_ANY || (ops[pi].type == PAT_CHAR && ops[pi].c == c)
+			|| (ops[pi].type == PAT_SET && (matcher->sets[ops[pi].set][c >> 3] >> (c & 7) & 1))))
+		{
+			pi++;
+			wi++;
+			continue;
+		}
+
+		// let the last star take one more byte and try again
+		if (starPi == -1)
+		{
+			return 0;
+		}
+
+		pi = starPi + 1;
+		wi = ++starWi;
+	}
+
+	while (pi < pattern->count && ops[pi].type == PAT_STAR)
+	{
+		pi++;
+	}
+
+	return pi == pattern->count;
+}
+
+
+/* Function that frees a matcher and its patterns.
+ * Takes the matcher, or NULL. */
+
+void matcherFree(struct Matcher *matcher)
+{
+	int i;
+
+	if (matcher == NULL)
+	{
+		return;
+	}
+
+	for (i = 0; i < matcher->count; i++)
+	{
+		free(matcher->patterns[i].ops);
+		free(matcher->patterns[i].prefix);
+	}
+
+	free(matcher->patterns);
+	free(matcher->sets);
+	free(matcher->first);
+	free(matcher->last);
+	free(matcher->empty);
+	free(matcher);
+}
+
+
+/* Function that replaces a leading alias with the command parsed from its value,
+ * followed by the remaining arguments. Redirections and the background flag of
+ * the original line win over those in the alias. An alias whose value starts with
+ * another alias is expanded again, up to a limit, but never with itself.
+ * Takes the parsed Command struct.
+ * Returns a new Command struct, or NULL if the command does not start with an alias. */
+
+struct Command* applyAlias(struct Command *cmdInfo)
+{
+	struct Command *result = NULL;
+	struct Command *next;
+	struct Command *source = cmdInfo;
+	struct Name *name;
+	char *previous = NULL;
+	int depth;
+	int i;
+
+	for (depth = 0; depth < MAX_ALIAS_DEPTH; depth++)
+	{
+		name = lookupName(source->argv[0]);
+
+		if (name == NULL || name->alias == NULL || name->alias->argc == 0
+			|| (previous != NULL && strcmp(previous, name->key) == 0))
+		{
+			break;
+		}
+
+		previous = name->key;
+		next = malloc(sizeof(struct Command));
+		initCommand(next);
+		next->lineNo = cmdInfo->lineNo;
+
+		for (i = 0; i < name->alias->argc; i++)
+		{
+			addArg(next, strdup(name->alias->argv[i]));
+		}
+
+		for (i = 1; i < source->argc; i++)
+		{
+			addArg(next, strdup(source->argv[i]));
+		}
+
+		next->isBgProcess = source->isBgProcess || name->alias->isBgProcess;
+		next->wantsInputR = source->wantsInputR || name->alias->wantsInputR;
+		next->wantsOutputR = source->wantsOutputR || name->alias->wantsOutputR;
+		next->inRedirFile = source->wantsInputR ? source->inRedirFile : name->alias->inRedirFile;
+		next->outRedirFile = source->wantsOutputR ? source->outRedirFile : name->alias->outRedirFile;
+		next->inRedirFile = next->inRedirFile ? strdup(next->inRedirFile) : NULL;
+		next->outRedirFile = next->outRedirFile ? strdup(next->outRedirFile) : NULL;
+
+		freeCommand(result);
+		result = next;
+		source = next;
+	}
+
+	return result;
+}
+
+
+/* Function that makes a copy of a command with its parameters expanded, leaving
+ * the original untouched. A word that is exactly "$@" becomes one argument per
+ * positional parameter.
+ * Takes the Command struct to expand.
+ * Returns a new Command struct, or NULL if a word could not be expanded. */
+
+struct Command* expandCommand(struct Command *raw)
+{
+	struct Command *cmdInfo = malloc(sizeof(struct Command));
+	int i;
+	int j;
+
+	initCommand(cmdInfo);
+	cmdInfo->lineNo = raw->lineNo;
+	cmdInfo->isBgProcess = raw->isBgProcess;
+	cmdInfo->wantsInputR = raw->wantsInputR;
+	cmdInfo->wantsOutputR = raw->wantsOutputR;
+	cmdInfo->inRedirFile = raw->inRedirFile ? expandText(raw, raw->inRedirFile, NULL) : NULL;
+	cmdInfo->outRedirFile = raw->outRedirFile ? expandText(raw, raw->outRedirFile, NULL) : NULL;
+
+	if ((raw->inRedirFile && cmdInfo->inRedirFile == NULL)
+		|| (raw->outRedirFile && cmdInfo->outRedirFile == NULL))
+	{
+		freeCommand(cmdInfo);
+		return NULL;
+	}
+
+	for (i = 0; i < raw->argc; i++)
+	{
+		if (strcmp(raw->argv[i], "$@") == 0 || strcmp(raw->argv[i], "\"$@\"") == 0)
+		{
+			for (j = 1; j <= POSCOUNT; j++)
+			{
+				addArg(cmdInfo, strdup(POSARGS[j]));
+			}
+		}
+		else if (expandBraces(raw, cmdInfo, raw->argv[i], 0) == -1)
+		{
+			freeCommand(cmdInfo);
+			return NULL;
+		}
+	}
+
+	return cmdInfo;
+}
+
+
+/* Function that generates the words of the first brace group in a word, like
+ * file{1..3}.dat or {src,include}/x.h, straight into a command's arguments. Every
+ * group is turned like an odometer wheel, last group fastest, so each word is
+ * built once in a single buffer. Groups left in a word, like nested ones, are
+ * expanded again for each word made.
+ * Takes the Command struct the word belongs to, the Command struct to add the
+ * words to, the word and how many times this word has been expanded already.
+ * Returns 0 on success or -1 after printing an error. */
+
+int expandBraces(struct Command *raw, struct Command *cmdInfo, const char *word, int depth)
+{
+	struct Brace *braces;
+	int64_t at[MAX_BRACES];
+	int64_t total = 1;
+	int64_t value;
+	const char *quoted;
+	char *buffer;
+	size_t size = strlen(word) + 1;
+	size_t len;
+	int count = 0;
+	int result = 0;
+	int from;
+	int to;
+	int g;
+	int i;
+
+	if (strchr(word, '{') == NULL)
+	{
+		return expandWord(raw, cmdInfo, strdup(word));
+	}
+
+	braces = malloc(MAX_BRACES * sizeof(struct Brace));
+
+	for (i = 0; word[i] != '\0' && count < MAX_BRACES; i++)
+	{
+		// quoted braces are not groups, and ${name} is a variable
+		if (word[i] == '\'' || word[i] == '"' || word[i] == '\\')
+		{
+			// a quote left open runs to the end of the word
+			quoted = skipQuoted(word + i);
+			i = quoted - word - (*quoted == '\0');
+		}
+		else if (word[i] == '{' && (i == 0 || word[i - 1] != '$') && braceParse(word, i, &braces[count]))
+		{
+			total *= braces[count].count;
+			size += braces[count].width + 24;
+			i = braces[count++].close;
+
+			if (total > BRACE_LIMIT || cmdInfo->argc + total > BRACE_LIMIT)
+			{
+				fprintf(stderr, "%s: brace expansion makes more than %d words\n", word, BRACE_LIMIT);
+				free(braces);
+				return -1;
+			}
+		}
+	}
+
+	if (count == 0 || depth >= MAX_BRACES)
+	{
+		free(braces);
+		return expandWord(raw, cmdInfo, strdup(word));
+	}
+
+	buffer = malloc(size);
+	memset(at, 0, sizeof(at));
+
+	while (result == 0)
+	{
+		len = 0;
+		from = 0;
+
+		for (g = 0; g < count; g++)
+		{
+			memcpy(buffer + len, word + from, braces[g].open - from);
+			len += braces[g].open - from;
+
+			if (braces[g].step == 0)
+			{
+				// a list word runs from the comma before it to the comma after it
+				from = at[g] == 0 ? braces[g].open + 1 : braces[g].commas[at[g] - 1] + 1;
+				to = at[g] == braces[g].count - 1 ? braces[g].close : braces[g].commas[at[g]];
+				memcpy(buffer + len, word + from, to - from);
+				len += to - from;
+			}
+			else
+			{
+				value = braces[g].from + at[g] * braces[g].step;
+
+				if (braces[g].isChar == 1)
+				{
+					buffer[len++] = (char)value;
+				}
+				else
+				{
+					len += sprintf(buffer + len, "%0*lld", braces[g].width, (long long)value);
+				}
+			}
+
+			from = braces[g].close + 1;
+		}
+
+		strcpy(buffer + len, word + from);
+		result = expandBraces(raw, cmdInfo, buffer, depth + 1);
+
+		// turn the last wheel, carrying into the ones before it
+		for (g = count - 1; g >= 0 && ++at[g] == braces[g].count; g--)
+		{
+			at[g] = 0;
+		}
+
+		if (g < 0)
+		{
+			break;
+		}
+	}
+
+	free(buffer);
+	free(braces);
+
+	return result;
+}
+
+
+/* Function that reads a brace group: a list of words split by commas outside any
+ * inner braces, or a range of integers or characters with an optional step. A
+ * group with neither is not a group and is kept as written.
+ * Takes the word, the offset of the opening brace and the Brace struct to fill.
+ * Returns bool int of whether there is a group at the offset. */
+
+int braceParse(const char *word, int open, struct Brace *brace)
+{
+	const char *parts[3];
+	const char *quoted;
+	char *end;
+	int64_t to;
+	int depth = 0;
+	int dots = 0;
+	int i;
+
+	brace->open = open;
+	brace->count = 1;
+	brace->step = 0;
+	brace->width = 0;
+	brace->isChar = 0;
+
+	for (i = open + 1; word[i] != '\0'; i++)
+	{
+		if (word[i] == '\'' || word[i] == '"' || word[i] == '\\')
+		{
+			// a quote left open runs to the end of the word
+			quoted = skipQuoted(word + i);
+			i = quoted - word - (*quoted == '\0');
+		}
+		else if (word[i] == '{')
+		{
+			depth++;
+		}
+		else if (word[i] == '}' && depth-- == 0)
+		{
+			break;
+		}
+		else if (word[i] == ',' && depth == 0 && brace->count < MAX_CMD_ARGS)
+		{
+			brace->commas[brace->count++ - 1] = i;
+		}
+	}
+
+	if (word[i] != '}')
+	{
+		return 0;
+	}
+
+	brace->close = i;
+
+	if (brace->count > 1)
+	{
+		return 1;
+	}
+
+	// a range is two or three values split by '..'
+	parts[0] = word + open + 1;
+
+	for (i = open + 1; i + 1 < brace->close; i++)
+	{
+		if (word[i] == '.' && word[i + 1] == '.')
+		{
+			if (++dots > 2)
+			{
+				return 0;
+			}
+
+			parts[dots] = word + i + 2;
+			i++;
+		}
+	}
+
+	if (dots == 0)
+	{
+		return 0;
+	}
+
+	if (parts[1] - parts[0] == 3 && (dots == 1 ? word + brace->close : parts[2] - 2) - parts[1] == 1)
+	{
+		brace->isChar = 1;
+		brace->from = (unsigned char)parts[0][0];
+		to = (unsigned char)parts[1][0];
+	}
+	else
+	{
+		brace->from = strtoll(parts[0], &end, 10);
+
+		if (end != parts[1] - 2 || end == parts[0])
+		{
+			return 0;
+		}
+
+		to = strtoll(parts[1], &end, 10);
+
+		if (end != (dots == 1 ? word + brace->close : parts[2] - 2) || end == parts[1])
+		{
+			return 0;
+		}
+
+		// a leading zero on either end pads every value to the longer end
+		if ((parts[0][0] == '0' || (parts[0][0] == '-' && parts[0][1] == '0')) && parts[1] - parts[0] > 3)
+		{
+			brace->width = parts[1] - parts[0] - 2;
+		}
+
+		if ((parts[1][0] == '0' || (parts[1][0] == '-' && parts[1][1] == '0')) && end - parts[1] > 1
+			&& end - parts[1] > brace->width)
+		{
+			brace->width = end - parts[1];
+		}
+	}
+
+	brace->step = 1;
+
+	if (dots == 2)
+	{
+		brace->step = strtoll(parts[2], &end, 10);
+
+		if (end != word + brace->close || end == parts[2])
+		{
+			return 0;
+		}
+
+		brace->step = brace->step < 0 ? -brace->step : brace->step;
+		brace->step = brace->step == 0 ? 1 : brace->step;
+	}
+
+	brace->count = (to >= brace->from ? to - brace->from : brace->from - to) / brace->step + 1;
+	brace->step = to >= brace->from ? brace->step : -brace->step;
+
+	return 1;
+}
+
+
+/* Function that expands the parameters in a word and adds it to a command, or
+ * the paths it matches if it has wildcards outside quotes that match any.
+ * Takes the Command struct the word belongs to, the Command struct to add it to
+ * and the word in allocated memory, which is freed.
+ * Returns 0 on success or -1 after printing an error. */
+
+int expandWord(struct Command *raw, struct Command *cmdInfo, char *word)
+{
+	char *mask;
+	char *expanded = expandText(raw, word, &mask);
+	char *pattern;
+	glob_t paths;
+	int found = 0;
+	int i;
+
+	free(word);
+
+	if (expanded == NULL)
+	{
+		return -1;
+	}
+
+	// words with wildcards that were not quoted become the paths they match, if any
+	for (i = 0; expanded[i] != '\0' && found == 0; i++)
+	{
+		found = mask[i] == 0 && strchr("*?[", expanded[i]) != NULL;
+	}
+
+	if (found == 1)
+	{
+		pattern = globEscape(expanded, mask);
+		found = glob(pattern, 0, NULL, &paths) == 0;
+		free(pattern);
+	}
+
+	free(mask);
+
+	if (found)
+	{
+		for (i = 0; i < (int)paths.gl_pathc; i++)
+		{
+			addArg(cmdInfo, strdup(paths.gl_pathv[i]));
+		}
+
+		globfree(&paths);
+		free(expanded);
+	}
+	else
+	{
+		addArg(cmdInfo, expanded);
+	}
+
+	return 0;
+}
+
+
+/* Function that expands the parameters in a word: $0 to $9, $# for the number of
+ * positional parameters, $@ and $* for all of them, $$ for the shell's process id,
+ * $? for the last exit value, $name and ${name} for variables and $((...)) for
+ * arithmetic. Nothing is expanded in single quotes, parameters are expanded in
+ * double quotes, and the quotes and the backslashes quoting a character are
+ * removed.
+ * Takes the Command struct the word belongs to, which caches compiled arithmetic,
+ * the word and, if wanted, a pointer to set to a mask with a byte per byte of the
+ * result that is 1 where the result was quoted.
+ * Returns the expanded word in newly allocated memory, or NULL after printing an
+ * error. */
+
+char* expandText(struct Command *raw, const char *word, char **mask)
+{
+	char *result;
+	char *quotes = NULL;
+	char number[32];
+	char key[MAX_CMD_CHARS];
+	const char *value;
+	const char *end;
+	size_t len = 0;
+	size_t cap = strlen(word) + 1;
+	size_t keyLen;
+	struct Arith *tree;
+	int64_t arith;
+	int quoted = 0;
+	int depth;
+	int error;
+	int i;
+
+	// most words have nothing to expand
+	if (strpbrk(word, "$'\"\\") == NULL)
+	{
+		if (mask != NULL)
+		{
+			*mask = calloc(cap, 1);
+		}
+
+		return strdup(word);
+	}
+
+	result = malloc(cap);
+
+	if (mask != NULL)
+	{
+		quotes = malloc(cap);
+	}
+
+	while (*word != '\0')
+	{
+		value = NULL;
+		end = word + 2;
+
+		if (word[0] == '"')
+		{
+			quoted = !quoted;
+			word++;
+			continue;
+		}
+		else if (word[0] == '\'' && quoted == 0)
+		{
+			end = skipQuoted(word);
+			appendMasked(&result, mask ? &quotes : NULL, &len, &cap, word + 1, end - word - (*end != '\0'), 1);
+			word = *end != '\0' ? end + 1 : end;
+			continue;
+		}
+		else if (word[0] == '\\' && word[1] != '\0')
+		{
+			// in double quotes only some characters can be quoted this way
+			if (quoted == 1 && strchr("$`\"\\\n", word[1]) == NULL)
+			{
+				appendMasked(&result, mask ? &quotes : NULL, &len, &cap, word, 1, 1);
+			}
+
+			appendMasked(&result, mask ? &quotes : NULL, &len, &cap, word + 1, 1, 1);
+			word += 2;
+			continue;
+		}
+		else if (word[0] != '$')
+		{
+			// copy up to the next special character in one go
+			end = word + strcspn(word, quoted ? "$\"\\" : "$'\"\\");
+			end += end == word;
+			appendMasked(&result, mask ? &quotes : NULL, &len, &cap, word, end - word, quoted);
+			word = end;
+			continue;
+		}
+		else if (strncmp(word, "$((", 3) == 0)
+		{
+			// find the '))' matching the opening, allowing nested parentheses
+			for (end = word + 3, depth = 0; *end != '\0'; end++)
+			{
+				if (*end == '(')
+				{
+					depth++;
+				}
+				else if (*end == ')' && depth > 0)
+				{
+					depth--;
+				}
+				else if (*end == ')' && end[1] == ')')
+				{
+					break;
+				}
+			}
+
+			if (*end == '\0')
+			{
+				fprintf(stderr, "arithmetic: missing '))'\n");
+				free(result);
+				free(quotes);
+				return NULL;
+			}
+
+			tree = arithCompile(raw, word + 3, end - word - 3);
+			error = 0;
+			arith = tree ? arithEval(tree, &error) : 0;
+
+			if (tree == NULL || error == 1)
+			{
+				free(result);
+				free(quotes);
+				return NULL;
+			}
+
+			sprintf(number, "%lld", (long long)arith);
+			value = number;
+			end += 2;
+		}
+		else if (word[1] >= '0' && word[1] <= '9')
+		{
+			i = word[1] - '0';
+			value = i <= POSCOUNT ? POSARGS[i] : "";
+
+			if (i > POSCOUNT && NOUNSET == 1)
+			{
+				fprintf(stderr, "$%c: unbound variable\n", word[1]);
+				free(result);
+				free(quotes);
+				return NULL;
+			}
+		}
+		else if (word[1] == '#')
+		{
+			sprintf(number, "%d", POSCOUNT);
+			value = number;
+		}
+		else if (word[1] == '$')
+		{
+			sprintf(number, "%d", (int)getpid());
+			value = number;
+		}
+		else if (word[1] == '?')
+		{
+			sprintf(number, "%d", lastStatus());
+			value = number;
+		}
+		else if (word[1] == '@' || word[1] == '*')
+		{
+			// joined with spaces
+			for (i = 1; i <= POSCOUNT; i++)
+			{
+				appendMasked(&result, mask ? &quotes : NULL, &len, &cap, " ", i > 1, quoted);
+				appendMasked(&result, mask ? &quotes : NULL, &len, &cap, POSARGS[i], strlen(POSARGS[i]), quoted);
+			}
+
+			word += 2;
+			continue;
+		}
+		else if (word[1] == '_' || isalpha((unsigned char)word[1])
+			|| (word[1] == '{' && strchr(word, '}') != NULL))
+		{
+			// $name runs to the last name character, ${name} to the brace
+			if (word[1] == '{')
+			{
+				keyLen = strchr(word, '}') - word - 2;
+				end = word + keyLen + 3;
+				word++;
+			}
+			else
+			{
+				end = nameEnd(word + 1);
+				keyLen = end - word - 1;
+			}
+
+			if (keyLen >= sizeof key)
+			{
+				keyLen = sizeof key - 1;
+			}
+
+			memcpy(key, word + 1, keyLen);
+			key[keyLen] = '\0';
+			value = getVar(key);
+
+			if (value == NULL && NOUNSET == 1)
+			{
+				fprintf(stderr, "%s: unbound variable\n", key);
+				free(result);
+				free(quotes);
+				return NULL;
+			}
+
+			value = value ? value : "";
+		}
+
+		// a lone '$' is kept as is
+		if (value == NULL)
+		{
+			value = "$";
+			end = word + 1;
+		}
+
+		appendMasked(&result, mask ? &quotes : NULL, &len, &cap, value, strlen(value), quoted);
+		word = end;
+	}
+
+	result[len] = '\0';
+
+	if (mask != NULL)
+	{
+		*mask = quotes;
+	}
+
+	return result;
+}
+
+
+/* Function that appends text to a growing string, keeping room for the NUL.
+ * Takes pointers to the string, its length and capacity, and the text to add. */
+
+void appendText(char **text, size_t *len, size_t *cap, const char *add, size_t addLen)
+{
+	if (*len + addLen + 1 > *cap)
+	{
+		*cap = (*len + addLen + 1) * 2;
+		*text = realloc(*text, *cap);
+	}
+
+	memcpy(*text + *len, add, addLen);
+	*len += addLen;
+}
+
+
+/* Function that appends text to a growing string like appendText, and marks the
+ * bytes added as quoted or not in a mask kept the same size as the string.
+ * Takes pointers to the string, the mask or NULL for none, the string's length
+ * and capacity, the text to add and bool int of whether it is quoted. */
+
+void appendMasked(char **text, char **mask, size_t *len, size_t *cap, const char *add, size_t addLen, int quoted)
+{
+	size_t oldCap = *cap;
+
+	appendText(text, len, cap, add, addLen);
+
+	if (mask != NULL)
+	{
+		if (*cap != oldCap)
+		{
+			*mask = realloc(*mask, *cap);
+		}
+
+		memset(*mask + *len - addLen, quoted, addLen);
+	}
+}
+
+
+/* Function that turns an expanded word into a glob pattern in which only the
+ * wildcards that were not quoted are special, by putting a backslash before the
+ * quoted ones.
+ * Takes the expanded word and its quote mask from expandText.
+ * Returns the pattern in newly allocated memory. */
+
+char* globEscape(const char *text, const char *mask)
+{
+	char *pattern = malloc(2 * strlen(text) + 1);
+	size_t len = 0;
+	int i;
+
+	for (i = 0; text[i] != '\0'; i++)
+	{
+		if (mask[i] == 1 && strchr("*?[]\\", text[i]) != NULL)
+		{
+			pattern[len++] = '\\';
+		}
+
+		pattern[len++] = text[i];
+	}
+
+	pattern[len] = '\0';
+
+	return pattern;
+}
+
+
+/* Function that checks if a word assigns a variable, 'name=value'.
+ * Takes the word.
+ * Returns bool int of whether it is an assignment. */
+
+int isAssignment(const char *word)
+{
+	const char *end = nameEnd(word);
+
+	return end != word && *end == '=';
+}
+
+
+/* Function that finds the end of the variable name a word starts with.
+ * Takes the word.
+ * Returns a pointer just past the name, or the word itself if it does not start
+ * with a name. */
+
+const char* nameEnd(const char *word)
+{
+	const char *p = word;
+
+	if (*p != '_' && !isalpha((unsigned char)*p))
+	{
+		return word;
+	}
+
+	while (*p == '_' || isalnum((unsigned char)*p))
+	{
+		p++;
+	}
+
+	return p;
+}
+
+
+/* Function that looks up a variable, falling back to the environment for names
+ * the shell has not set itself. A number names a positional parameter.
+ * Takes the variable name.
+ * Returns the value, or NULL if the variable is not set. */
+
+const char* getVar(const char *key)
+{
+	struct Name *name;
+	int i;
+
+	if (isdigit((unsigned char)key[0]))
+	{
+		i = atoi(key);
+		return i <= POSCOUNT ? POSARGS[i] : NULL;
+	}
+
+	name = lookupName(key);
+
+	if (name != NULL && name->value != NULL)
+	{
+		return name->value;
+	}
+
+	return getenv(key);
+}
+
+
+/* Function that sets a shell variable. Variables that came from the environment or
+ * were exported are updated there too so children see the new value.
+ * Takes the variable name and value. */
+
+void setVar(const char *key, const char *value)
+{
+	struct Name *name = insertName(key);
+
+	free(name->value);
+	name->value = strdup(value);
+
+	if (name->exported == 1 || getenv(key) != NULL)
+	{
+		name->exported = 1;
+		setenv(key, value, 1);
+	}
+}
+
+
+/* Function that finds the compiled tree for an arithmetic expression in a command,
+ * compiling and caching it the first time so loops and function bodies only parse
+ * each expression once.
+ * Takes the Command struct the expression belongs to, the expression inside
+ * '$((' and '))' and its length.
+ * Returns the tree, or NULL after printing an error. */
+
+struct Arith* arithCompile(struct Command *raw, const char *at, size_t len)
+{
+	struct Arith *tree;
+	char *text;
+	const char *p;
+	int i;
+
+	for (i = 0; i < raw->arithCount; i++)
+	{
+		if (raw->arith[i].len == len && memcmp(raw->arith[i].text, at, len) == 0)
+		{
+			return raw->arith[i].tree;
+		}
+	}
+
+	text = strndup(at, len);
+	p = text;
+	tree = arithParse(&p, 0);
+
+	while (*p == ' ' || *p == '\t')
+	{
+		p++;
+	}
+
+	if (tree == NULL || *p != '\0')
+	{
+		fprintf(stderr, "arithmetic: syntax error in '%s'\n", text);
+		metrics.parseErrors++;
+		arithFree(tree);
+		free(text);
+		return NULL;
+	}
+
+	// the cache keeps the text as its key
+	raw->arith = realloc(raw->arith, (raw->arithCount + 1) * sizeof(struct ArithCache));
+	raw->arith[raw->arithCount].text = text;
+	raw->arith[raw->arithCount].len = len;
+	raw->arith[raw->arithCount].tree = tree;
+	raw->arithCount++;
+
+	return tree;
+}
+
+
+/* Function that parses binary operators by precedence climbing, from the comma
+ * operator at level 0 down to multiplication at level 11, with assignment and ?:
+ * handled at their own levels since they group right to left.
+ * Takes a pointer to the parse position, which is advanced, and the lowest level
+ * allowed.
+ * Returns the tree, or NULL on a syntax error. */
+
+struct Arith* arithParse(const char **p, int level)
+{
+	struct Arith *left;
+	struct Arith *right;
+	struct Arith *node;
+	const char *save;
+	int op;
+
+	left = arithUnary(p);
+
+	while (left != NULL)
+	{
+		save = *p;
+		op = arithOperator(p, level);
+
+		if (op == 0)
+		{
+			break;
+		}
+
+		// '?:' takes the middle up to ':' and then the rest at the same level
+		if ((op & 0xffff) == '?')
+		{
+			node = arithNode(ARITH_TERNARY, '?', left, arithParse(p, 1));
+
+			while (**p == ' ' || **p == '\t')
+			{
+				(*p)++;
+			}
+
+			if (node->right == NULL || **p != ':')
+			{
+				arithFree(node);
+				return NULL;
+			}
+
+			(*p)++;
+			node->third = arithParse(p, 2);
+
+			if (node->third == NULL)
+			{
+				arithFree(node);
+				return NULL;
+			}
+
+			left = node;
+			continue;
+		}
+
+		// assignments need a variable on the left and group right to left
+		if ((op >> 16) == 1)
+		{
+			if (left->type != ARITH_VAR)
+			{
+				*p = save;
+				arithFree(left);
+				return NULL;
+			}
+
+			right = arithParse(p, 1);
+			node = arithNode(ARITH_ASSIGN, op & 0xffff, NULL, right);
+			node->name = left->name;
+			left->name = NULL;
+			arithFree(left);
+			left = node;
+
+			if (right == NULL)
+			{
+				arithFree(left);
+				return NULL;
+			}
+
+			continue;
+		}
+
+		// left to right, the right side binds anything tighter than this operator
+		right = arithParse(p, (op >> 16) + 1);
+		left = arithNode(ARITH_BINARY, op & 0xffff, left, right);
+
+		if (right == NULL)
+		{
+			arithFree(left);
+			return NULL;
+		}
+	}
+
+	return left;
+}
+
+
+/* Function that parses a number, variable, parenthesized expression, or a unary
+ * operator applied to one, including pre and post increment and decrement.
+ * Takes a pointer to the parse position, which is advanced.
+ * Returns the tree, or NULL on a syntax error. */
+
+struct Arith* arithUnary(const char **p)
+{
+	struct Arith *node;
+	const char *start;
+	char *end;
+
+	while (**p == ' ' || **p == '\t')
+	{
+		(*p)++;
+	}
+
+	start = *p;
+
+	// pre increment and decrement
+	if ((start[0] == '+' || start[0] == '-') && start[1] == start[0])
+	{
+		*p += 2;
+		node = arithUnary(p);
+
+		if (node == NULL || node->type != ARITH_VAR)
+		{
+			arithFree(node);
+			return NULL;
+		}
+
+		node->type = ARITH_PREINC;
+		node->op = start[0];
+		return node;
+	}
+
+	if (*start == '+' || *start == '-' || *start == '!' || *start == '~')
+	{
+		(*p)++;
+		node = arithUnary(p);
+		return node ? arithNode(ARITH_UNARY, *start, node, NULL) : NULL;
+	}
+
+	if (*start == '(')
+	{
+		(*p)++;
+		node = arithParse(p, 0);
+
+		while (**p == ' ' || **p == '\t')
+		{
+			(*p)++;
+		}
+
+		if (node == NULL || **p != ')')
+		{
+			arithFree(node);
+			return NULL;
+		}
+
+		(*p)++;
+	}
+	else if (isdigit((unsigned char)*start))
+	{
+		// base prefixes as in C
+		node = arithNode(ARITH_NUM, 0, NULL, NULL);
+		node->value = (int64_t)strtoull(start, &end, 0);
+		*p = end;
+	}
+	else if (*start == '_' || isalpha((unsigned char)*start) || *start == '$')
+	{
+		// '$name' means the same as 'name', and '$1' is a positional parameter
+		if (*start == '$')
+		{
+			start++;
+		}
+
+		if (isdigit((unsigned char)*start) && start[-1] == '$')
+		{
+			for (*p = start; isdigit((unsigned char)**p); (*p)++);
+		}
+		else
+		{
+			*p = nameEnd(start);
+		}
+
+		if (*p == start)
+		{
+			return NULL;
+		}
+
+		node = arithNode(ARITH_VAR, 0, NULL, NULL);
+		node->name = strndup(start, *p - start);
+	}
+	else
+	{
+		return NULL;
+	}
+
+	while (**p == ' ' || **p == '\t')
+	{
+		(*p)++;
+	}
+
+	// post increment and decrement
+	if (node->type == ARITH_VAR && ((*p)[0] == '+' || (*p)[0] == '-') && (*p)[1] == (*p)[0])
+	{
+		node->type = ARITH_POSTINC;
+		node->op = (*p)[0];
+		*p += 2;
+	}
+
+	return node;
+}
+
+
+/* Function that makes a tree node.
+ * Takes the node type, operator and left and right operands.
+ * Returns the node. */
+
+struct Arith* arithNode(int type, int op, struct Arith *left, struct Arith *right)
+{
+	struct Arith *node = calloc(1, sizeof(struct Arith));
+
+	node->type = type;
+	node->op = op;
+	node->left = left;
+	node->right = right;
+
+	return node;
+}
+
+
+/* Function that reads a binary operator if one of at least the given level is
+ * next. Levels from loosest to tightest are: 0 ',', 1 assignments, 2 '?:', 3 '||',
+ * 4 '&&', 5 '|', 6 '^', 7 '&', 8 '==' '!=', 9 '<' '<=' '>' '>=', 10 '<<' '>>',
+ * 11 '+' '-', 12 '*' '/' '%'.
+ * Takes a pointer to the parse position, advanced past the operator if one is read,
+ * and the lowest level allowed.
+ * Returns the operator with its level in the upper bits, or 0 if there is no
+ * operator to read. */
+
+int arithOperator(const char **p, int level)
+{
+	static const struct
+	{
+		const char *text;
+		int op;
+		int level;
+	} ops[] = {
+		{ "<<=", 'l', 1 }, { ">>=", 'r', 1 }, { "||", 'o', 3 }, { "&&", 'a', 4 },
+		{ "==", 'e', 8 }, { "!=", 'n', 8 }, { "<=", 'L', 9 }, { ">=", 'G', 9 },
+		{ "<<", 'l', 10 }, { ">>", 'r', 10 }, { "+=", '+', 1 }, { "-=", '-', 1 },
+		{ "*=", '*', 1 }, { "/=", '/', 1 }, { "%=", '%', 1 }, { "&=", '&', 1 },
+		{ "^=", '^', 1 }, { "|=", '|', 1 }, { ",", ',', 0 }, { "=", '=', 1 },
+		{ "?", '?', 2 }, { "|", '|', 5 }, { "^", '^', 6 }, { "&", '&', 7 },
+		{ "<", '<', 9 }, { ">", '>', 9 }, { "+", '+', 11 }, { "-", '-', 11 },
+		{ "*", '*', 12 }, { "/", '/', 12 }, { "%", '%', 12 }
+	};
+	size_t i;
+	size_t len;
+
+	while (**p == ' ' || **p == '\t')
+	{
+		(*p)++;
+	}
+
+	// longest operators are listed first so '<<=' is not read as '<'
+	for (i = 0; i < sizeof ops / sizeof ops[0]; i++)
+	{
+		len = strlen(ops[i].text);
+
+		if (strncmp(*p, ops[i].text, len) == 0)
+		{
+			if (ops[i].level < level)
+			{
+				return 0;
+			}
+
+			*p += len;
+
+			return (ops[i].level << 16) | ops[i].op;
+		}
+	}
+
+	return 0;
+}
+
+
+/* Function that evaluates a compiled expression with 64 bit wrap around.
+ * Takes the tree and a pointer to the error flag, set after printing an error.
+ * Returns the value. */
+
+int64_t arithEval(struct Arith *node, int *error)
+{
+	const char *text;
+	char number[32];
+	int64_t value;
+	int64_t right;
+
+	switch (node->type)
+	{
+		case ARITH_NUM:
+			return node->value;
+
+		case ARITH_VAR:
+		case ARITH_PREINC:
+		case ARITH_POSTINC:
+			text = getVar(node->name);
+			value = text ? (int64_t)strtoll(text, NULL, 0) : 0;
+
+			if (text == NULL && NOUNSET == 1)
+			{
+				fprintf(stderr, "%s: unbound variable\n", node->name);
+				*error = 1;
+				return 0;
+			}
+
+			if (node->type == ARITH_VAR)
+			{
+				return value;
+			}
+
+			right = (int64_t)((uint64_t)value + (node->op == '+' ? 1 : -1));
+			sprintf(number, "%lld", (long long)right);
+			setVar(node->name, number);
+			return node->type == ARITH_PREINC ? right : value;
+
+		case ARITH_UNARY:
+			value = arithEval(node->left, error);
+
+			switch (node->op)
+			{
+				case '-':
+					return (int64_t)(0 - (uint64_t)value);
+				case '!':
+					return !value;
+				case '~':
+					return ~value;
+				default:
+					return value;
+			}
+
+		case ARITH_TERNARY:
+			value = arithEval(node->left, error);
+			return value ? arithEval(node->right, error) : arithEval(node->third, error);
+
+		case ARITH_ASSIGN:
+			right = arithEval(node->right, error);
+
+			if (node->op != '=')
+			{
+				text = getVar(node->name);
+				value = text ? (int64_t)strtoll(text, NULL, 0) : 0;
+				right = arithApply(node->op, value, right, error);
+			}
+
+			if (*error == 0)
+			{
+				sprintf(number, "%lld", (long long)right);
+				setVar(node->name, number);
+			}
+
+			return right;
+
+		default:
+			// '&&' and '||' only evaluate the right side when needed
+			value = arithEval(node->left, error);
+
+			if (node->op == 'a' && value == 0)
+			{
+				return 0;
+			}
+
+			if (node->op == 'o' && value != 0)
+			{
+				return 1;
+			}
+
+			right = arithEval(node->right, error);
+
+			return *error ? 0 : arithApply(node->op, value, right, error);
+	}
+}
+
+
+/* Function that applies a binary operator.
+ * Takes the operator, both operands and a pointer to the error flag.
+ * Returns the result. */
+
+int64_t arithApply(int op, int64_t left, int64_t right, int *error)
+{
+	uint64_t a = (uint64_t)left;
+	uint64_t b = (uint64_t)right;
+
+	switch (op)
+	{
+		case '+': return (int64_t)(a + b);
+		case '-': return (int64_t)(a - b);
+		case '*': return (int64_t)(a * b);
+		case '/':
+		case '%':
+			if (right == 0)
+			{
+				fprintf(stderr, "arithmetic: division by zero\n");
+				*error = 1;
+				return 0;
+			}
+
+			// the one quotient that overflows
+			if (right == -1)
+			{
+				return op == '/' ? (int64_t)(0 - a) : 0;
+			}
+
+			return op == '/' ? left / right : left % right;
+		case 'l': return (int64_t)(a << (b & 63));
+		case 'r': return left >> (b & 63);
+		case '<': return left < right;
+		case '>': return left > right;
+		case 'L': return left <= right;
+		case 'G': return left >= right;
+		case 'e': return left == right;
+		case 'n': return left != right;
+		case '&': return left & right;
+		case '^': return left ^ right;
+		case '|': return left | right;
+		case 'a': return left && right;
+		case 'o': return left || right;
+		case ',': return right;
+	}
+
+	return 0;
+}
+
+
+/* Function that frees a compiled expression.
+ * Takes the tree, which may be NULL. */
+
+void arithFree(struct Arith *node)
+{
+	if (node == NULL)
+	{
+		return;
+	}
+
+	arithFree(node->left);
+	arithFree(node->right);
+	arithFree(node->third);
+	free(node->name);
+	free(node);
+}
+
+
+/* Function that runs the body of a function in the shell process with the call's
+ * arguments as the positional parameters, restoring the caller's afterwards. Loops
+ * of the caller are out of reach of the body, so 'break' and 'continue' only work
+ * in loops inside the function and are reported as errors anywhere else in it.
+ * Takes the function definition and the expanded call.
+ * Returns bool int of whether to continue shell loop or exiting. */
+
+int callFunction(struct Command *function, struct Command *cmdInfo)
+{
+	char **savedArgs = POSARGS;
+	int savedCount = POSCOUNT;
+	int savedLoops = LOOPDEPTH;
+	int exitCalled = 0;
+	int i;
+
+	if (CALLDEPTH == MAX_CALL_DEPTH)
+	{
+		fprintf(stderr, "%s: maximum function nesting exceeded\n", cmdInfo->argv[0]);
+		sprintf(ENDSTATE, "exit value 1");
+		return 0;
+	}
+
+	// $0 stays the shell's, the call's arguments become $1 and on
+	POSARGS = malloc((cmdInfo->argc + 1) * sizeof(char *));
+	POSARGS[0] = savedArgs[0];
+
+	for (i = 1; i <= cmdInfo->argc; i++)
+	{
+		POSARGS[i] = cmdInfo->argv[i];
+	}
+
+	POSCOUNT = cmdInfo->argc - 1;
+	CALLDEPTH++;
+	LOOPDEPTH = 0;
+	function->refs++;
+	sprintf(ENDSTATE, "exit value 0");
+
+	for (i = 0; i < function->bodyCount && exitCalled == 0 && RETURNING == 0; i++)
+	{
+		exitCalled = execCommand(function->body[i]);
+	}
+
+	// a loop left by 'return' does not leave break or continue behind
+	CALLDEPTH--;
+	LOOPDEPTH = savedLoops;
+	RETURNING = 0;
+	BREAKING = 0;
+	CONTINUING = 0;
+	free(POSARGS);
+	POSARGS = savedArgs;
+	POSCOUNT = savedCount;
+	freeCommand(function);
+
+	return exitCalled;
+}
+
+
+/* Function that runs a while loop, running the body for as long as the condition
+ * exits with value 0. Redirections from the closing 'done' line apply to the whole
+ * loop, so 'read' in the condition takes lines from the redirected file.
+ * Takes the loop Command struct.
+ * Returns bool int of whether to continue shell loop or exiting. */
+
+int runWhile(struct Command *loop)
+{
+	// the loop's value is that of the last command in the body, 0 if it never ran
+	char bodyState[MAX_CMD_CHARS] = "exit value 0";
+	struct Frame frame;
+	int exitCalled = 0;
+	int i;
+
+	if (pushFrame(loop, &frame) == -1)
+	{
+		sprintf(ENDSTATE, "exit value 1");
+		return 0;
+	}
+
+	LOOPDEPTH++;
+
+	while (exitCalled == 0 && RETURNING == 0)
+	{
+		CONDDEPTH++;
+		exitCalled = execCommand(loop->cond);
+		CONDDEPTH--;
+
+		if (exitCalled == 1 || lastStatus() != 0)
+		{
+			break;
+		}
+
+		for (i = 0; i < loop->bodyCount && exitCalled == 0; i++)
+		{
+			exitCalled = execCommand(loop->body[i]);
+
+			if (BREAKING == 1 || CONTINUING == 1 || RETURNING == 1)
+			{
+				break;
+			}
+		}
+
+		strcpy(bodyState, ENDSTATE);
+		CONTINUING = 0;
+
+		if (BREAKING == 1)
+		{
+			BREAKING = 0;
+			break;
+		}
+	}
+
+	LOOPDEPTH--;
+	popFrame(&frame);
+
+	if (RETURNING == 0)
+	{
+		strcpy(ENDSTATE, bodyState);
+	}
+
+	return exitCalled;
+}
+
+
+/* Function that applies a command's redirections to the shell process itself,
+ * saving the original stdin and stdout so popFrame can put them back. While stdin
+ * is replaced, 'read' gets a fresh reader for it and the command reader stops
+ * handing input back to the old stdin.
+ * Takes the Command struct with the redirections and the frame to fill.
+ * Returns 0 on success or -1 after printing an error. */
+
+int pushFrame(struct Command *cmdInfo, struct Frame *frame)
+{
+	char *file;
+	int fd;
+
+	frame->savedIn = -1;
+	frame->savedOut = -1;
+
+	if (cmdInfo->wantsInputR == 1)
+	{
+		file = cmdInfo->inRedirFile ? expandText(cmdInfo, cmdInfo->inRedirFile, NULL) : NULL;
+		fd = file ? open(file, O_RDONLY) : -1;
+
+		if (fd == -1)
+		{
+			fprintf(stderr, "cannot open %s for input\n", file ? file : "");
+			free(file);
+			return -1;
+		}
+
+		free(file);
+
+		// put back what was read ahead of the old stdin before it is swapped out
+		inputSync();
+		frame->savedIn = fcntl(0, F_DUPFD_CLOEXEC, 10);
+		frame->savedLineReader = lineReader;
+		frame->savedSeekable = reader.seekable;
+		dup2(fd, 0);
+		close(fd);
+
+		memset(&lineReader, 0, sizeof lineReader);
+		lineReader.seekable = lseek(0, 0, SEEK_CUR) != -1;
+		reader.seekable = reader.fd == 0 ? 0 : reader.seekable;
+		STDINFRAMES++;
+	}
+
+	if (cmdInfo->wantsOutputR == 1)
+	{
+		file = cmdInfo->outRedirFile ? expandText(cmdInfo, cmdInfo->outRedirFile, NULL) : NULL;
+		fd = file ? open(file, O_WRONLY | O_CREAT | O_TRUNC, 0644) : -1;
+
+		if (fd == -1)
+		{
+			fprintf(stderr, "cannot open %s for output\n", file ? file : "");
+			free(file);
+			popFrame(frame);
+			return -1;
+		}
+
+		free(file);
+
+		// queued output belongs to the old stdout
+		outFlush();
+		frame->savedOut = fcntl(1, F_DUPFD_CLOEXEC, 10);
+		dup2(fd, 1);
+		close(fd);
+	}
+
+	return 0;
+}
+
+
+/* Function that puts back the stdin and stdout saved by pushFrame.
+ * Takes the frame filled by pushFrame. */
+
+void popFrame(struct Frame *frame)
+{
+	if (frame->savedOut != -1)
+	{
+		outFlush();
+		dup2(frame->savedOut, 1);
+		close(frame->savedOut);
+		frame->savedOut = -1;
+	}
+
+	if (frame->savedIn != -1)
+	{
+		free(lineReader.buf);
+		lineReader = frame->savedLineReader;
+		reader.seekable = frame->savedSeekable;
+		dup2(frame->savedIn, 0);
+		close(frame->savedIn);
+		frame->savedIn = -1;
+		STDINFRAMES--;
+	}
+}
+
+
+/* Function that turns ENDSTATE back into a numeric exit status, with signals
+ * reported as 128 plus the signal number like other shells do.
+ * Returns the status of the last command. */
+
+int lastStatus()
+{
+	int value;
+
+	if (sscanf(ENDSTATE, "exit value %d", &value) == 1)
+	{
+		return value;
+	}
+
+	if (sscanf(ENDSTATE, "terminated by signal %d", &value) == 1)
+	{
+		return 128 + value;
+	}
+
+	return 0;
+}
+
+
+/* Function behind 'export' that passes the named variables on to children,
+ * assigning them first when given as 'name=value'.
+ * Returns 0 to continue the shell loop. */
+
+int builtinExport(struct Command *cmdInfo)
+{
+	struct Name *name;
+	char *equals;
+	int arg;
+
+	sprintf(ENDSTATE, "exit value 0");
+
+	for (arg = 1; arg < cmdInfo->argc; arg++)
+	{
+		equals = strchr(cmdInfo->argv[arg], '=');
+
+		if (equals != NULL)
+		{
+			*equals = '\0';
+		}
+
+		if (*nameEnd(cmdInfo->argv[arg]) != '\0' || cmdInfo->argv[arg][0] == '\0')
+		{
+			fprintf(stderr, "export: %s: not a valid name\n", cmdInfo->argv[arg]);
+			sprintf(ENDSTATE, "exit value 1");
+			continue;
+		}
+
+		name = insertName(cmdInfo->argv[arg]);
+		name->exported = 1;
+
+		if (equals != NULL)
+		{
+			setVar(cmdInfo->argv[arg], equals + 1);
+		}
+		else if (name->value != NULL)
+		{
+			setenv(name->key, name->value, 1);
+		}
+	}
+
+	return 0;
+}
+
+
+/* Function behind 'read' that reads a line from stdin and splits it into fields
+ * on the characters in IFS, assigning one field to each named variable with the
+ * rest of the line going to the last one, or the whole line to REPLY. Unless -r is
+ * given, a backslash keeps the next character literal and one at the end of the
+ * line joins the next line. Lines come from a buffered reader instead of one byte
+ * reads, which is the shell's own command reader when commands come from stdin.
+ * Returns 0 to continue the shell loop. */
+
+int builtinRead(struct Command *cmdInfo)
+{
+	struct Input *in = (reader.fd == 0 && STDINFRAMES == 0) ? &reader : &lineReader;
+	const char *ifs = getVar("IFS");
+	char *line;
+	char *text = NULL;
+	char *field;
+	char *p;
+	size_t len = 0;
+	size_t cap = 0;
+	int raw = 0;
+	int first = 1;
+	int arg;
+	int escaped;
+
+	if (cmdInfo->argc > 1 && strcmp(cmdInfo->argv[1], "-r") == 0)
+	{
+		raw = 1;
+		first = 2;
+	}
+
+	ifs = ifs ? ifs : DEFAULT_IFS;
+	sprintf(ENDSTATE, "exit value 0");
+
+	// gather the line, joining continued lines and dropping escaping backslashes
+	// escaped characters are marked with a leading \1 so splitting skips them
+	do
+	{
+		escaped = 0;
+
+		if ((line = readLine(in)) == NULL)
+		{
+			sprintf(ENDSTATE, "exit value 1");
+			break;
+		}
+
+		for (p = line; *p != '\0'; p++)
+		{
+			if (raw == 0 && *p == '\\')
+			{
+				if (p[1] == '\0')
+				{
+					escaped = 1;
+					break;
+				}
+
+				appendText(&text, &len, &cap, "\1", 1);
+				p++;
+			}
+
+			appendText(&text, &len, &cap, p, 1);
+		}
+	}while (escaped == 1);
+
+	appendText(&text, &len, &cap, "", 0);
+	text[len] = '\0';
+	p = text;
+
+	// with no names the whole line goes to REPLY
+	if (first == cmdInfo->argc)
+	{
+		for (field = p, len = 0; *p != '\0'; p++)
+		{
+			if (raw == 1 || *p != '\1')
+			{
+				field[len++] = *p;
+			}
+		}
+
+		field[len] = '\0';
+		setVar("REPLY", field);
+		free(text);
+		return 0;
+	}
+
+	for (arg = first; arg < cmdInfo->argc; arg++)
+	{
+		char *out;
+
+		// skip leading IFS whitespace
+		while (*p != '\0' && strchr(" \t\n", *p) && strchr(ifs, *p))
+		{
+			p++;
+		}
+
+		field = p;
+		out = p;
+
+		// the last name takes the rest of the line, less trailing IFS whitespace
+		while (*p != '\0')
+		{
+			if (raw == 0 && *p == '\1' && p[1] != '\0')
+			{
+				*out++ = *++p;
+				p++;
+				continue;
+			}
+
+			if (arg < cmdInfo->argc - 1 && strchr(ifs, *p))
+			{
+				break;
+			}
+
+			*out++ = *p++;
+		}
+
+		if (arg == cmdInfo->argc - 1)
+		{
+			while (out > field && strchr(" \t\n", out[-1]) && strchr(ifs, out[-1]))
+			{
+				out--;
+			}
+		}
+
+		// a non whitespace delimiter ends this field and the whitespace around it goes
+		if (*p != '\0')
+		{
+			int hard = strchr(" \t\n", *p) == NULL;
+
+			p++;
+
+			while (*p != '\0' && strchr(" \t\n", *p) && strchr(ifs, *p))
+			{
+				p++;
+			}
+
+			if (hard == 0 && *p != '\0' && strchr(ifs, *p))
+			{
+				p++;
+			}
+		}
+
+		*out = '\0';
+
+		if (isAssignment(cmdInfo->argv[arg]) || *nameEnd(cmdInfo->argv[arg]) != '\0'
+			|| cmdInfo->argv[arg][0] == '\0')
+		{
+			fprintf(stderr, "read: %s: not a valid name\n", cmdInfo->argv[arg]);
+			sprintf(ENDSTATE, "exit value 1");
+			continue;
+		}
+
+		setVar(cmdInfo->argv[arg], field);
+	}
+
+	free(text);
+
+	return 0;
+}
+
+
+/* Function behind 'break' and 'continue' that leaves the innermost loop or skips
+ * to its next round.
+ * Returns 0 to continue the shell loop. */
+
+int builtinBreak(struct Command *cmdInfo)
+{
+	if (LOOPDEPTH == 0)
+	{
+		fprintf(stderr, "%s: only meaningful in a loop\n", cmdInfo->argv[0]);
+		sprintf(ENDSTATE, "exit value 1");
+		return 0;
+	}
+
+	if (strcmp(cmdInfo->argv[0], "break") == 0)
+	{
+		BREAKING = 1;
+	}
+	else
+	{
+		CONTINUING = 1;
+	}
+
+	sprintf(ENDSTATE, "exit value 0");
+
+	return 0;
+}
+
+
+/* Function behind 'set' that turns shell options on with '-' and off with '+':
+ * -e (errexit), -u (nounset) and -o pipefail. Letters can be combined, as in -eu.
+ * With no arguments the options and their settings are printed.
+ * Returns 0 to continue the shell loop. */
+
+int builtinSet(struct Command *cmdInfo)
+{
+	const char *longNames[3] = { "errexit", "nounset", "pipefail" };
+	int *options[3] = { &ERREXIT, &NOUNSET, &PIPEFAIL };
+	const char *p;
+	int value;
+	int arg;
+	int i;
+
+	sprintf(ENDSTATE, "exit value 0");
+
+	if (cmdInfo->argc == 1)
+	{
+		for (i = 0; i < 3; i++)
+		{
+			outPrintf("%-10s%s\n", longNames[i], *options[i] ? "on" : "off");
+		}
+
+		return 0;
+	}
+
+	for (arg = 1; arg < cmdInfo->argc; arg++)
+	{
+		p = cmdInfo->argv[arg];
+		value = p[0] == '-';
+
+		if ((p[0] != '-' && p[0] != '+') || p[1] == '\0')
+		{
+			fprintf(stderr, "set: %s: invalid option\n", p);
+			sprintf(ENDSTATE, "exit value 2");
+			return 0;
+		}
+
+		// -o takes the long name of the option next
+		if (strcmp(p + 1, "o") == 0)
+		{
+			for (i = 0; arg + 1 < cmdInfo->argc && i < 3; i++)
+			{
+				if (strcmp(cmdInfo->argv[arg + 1], longNames[i]) == 0)
+				{
+					break;
+				}
+			}
+
+			if (arg + 1 == cmdInfo->argc || i == 3)
+			{
+				fprintf(stderr, "set: %s: invalid option name\n",
+					arg + 1 < cmdInfo->argc ? cmdInfo->argv[arg + 1] : "");
+				sprintf(ENDSTATE, "exit value 2");
+				return 0;
+			}
+
+			*options[i] = value;
+			arg++;
+			continue;
+		}
+
+		for (p++; *p != '\0'; p++)
+		{
+			if (*p == 'e')
+			{
+				ERREXIT = value;
+			}
+			else if (*p == 'u')
+			{
+				NOUNSET = value;
+			}
+			else
+			{
+				fprintf(stderr, "set: -%c: invalid option\n", *p);
+				sprintf(ENDSTATE, "exit value 2");
+				return 0;
+			}
+		}
+	}
+
+	return 0;
+}
+
+
+/* Function behind 'sched' that sets the priority of child processes.
+ * 'sched [-n nice] [-i idle|be[:level]] [-p other|batch|idle] command' runs command
+ * with that priority, '-b' with no command makes it the default for background
+ * jobs and '-a secs' turns on the scheduler that lowers background jobs' priority
+ * every secs seconds they run, with 0 turning it off. With no arguments the
+ * settings and running background jobs are listed.
+ * Returns bool int of whether to continue shell loop or exiting. */
+
+int builtinSched(struct Command *cmdInfo)
+{
+	const char *policies[3] = { "other", "batch", "idle" };
+	const int policyValues[3] = { SCHED_OTHER, SCHED_BATCH, SCHED_IDLE };
+	struct Priority prio = { NICE_KEEP, 0, 0, -1 };
+	struct timespec now;
+	char *value;
+	int background = 0;
+	int exitCalled;
+	int arg;
+	int i;
+
+	sprintf(ENDSTATE, "exit value 0");
+
+	if (cmdInfo->argc == 1)
+	{
+		clock_gettime(CLOCK_MONOTONIC, &now);
+		outPrintf("background:");
+
+		if (BGPRIORITY.nice != NICE_KEEP)
+		{
+			outPrintf(" nice %d", BGPRIORITY.nice);
+		}
+
+		if (BGPRIORITY.ioClass != 0)
+		{
+			outPrintf(" io %s:%d", BGPRIORITY.ioClass == IOPRIO_CLASS_IDLE ? "idle" : "be", BGPRIORITY.ioLevel);
+		}
+
+		for (i = 0; i < 3; i++)
+		{
+			if (BGPRIORITY.policy == policyValues[i])
+			{
+				outPrintf(" policy %s", policies[i]);
+			}
+		}
+
+		outPrintf("\nscheduler: ");
+		outPrintf(AUTOSCHED > 0 ? "every %gs\n" : "off\n", AUTOSCHED);
+
+		for (i = 0; i < JOBCOUNT; i++)
+		{
+			if (JOBS[i].background == 0)
+			{
+				continue;
+			}
+
+			outPrintf("%8d %8.1fs  step %d  %s\n", (int)JOBS[i].pid,
+				timeDiff(&JOBS[i].start, &now), JOBS[i].level, JOBS[i].name);
+		}
+
+		return 0;
+	}
+
+	for (arg = 1; arg < cmdInfo->argc && cmdInfo->argv[arg][0] == '-'; arg++)
+	{
+		if (strcmp(cmdInfo->argv[arg], "-b") == 0)
+		{
+			background = 1;
+			continue;
+		}
+
+		// every other option takes a value
+		value = arg + 1 < cmdInfo->argc ? cmdInfo->argv[++arg] : NULL;
+
+		if (value == NULL)
+		{
+			fprintf(stderr, "sched: %s: missing value\n", cmdInfo->argv[arg]);
+			sprintf(ENDSTATE, "exit value 2");
+			return 0;
+		}
+
+		if (strcmp(cmdInfo->argv[arg - 1], "-n") == 0)
+		{
+			prio.nice = atoi(value);
+		}
+		else if (strcmp(cmdInfo->argv[arg - 1], "-a") == 0)
+		{
+			AUTOSCHED = atof(value);
+		}
+		else if (strcmp(cmdInfo->argv[arg - 1], "-i") == 0 && strcmp(value, "idle") == 0)
+		{
+			prio.ioClass = IOPRIO_CLASS_IDLE;
+			prio.ioLevel = 0;
+		}
+		else if (strcmp(cmdInfo->argv[arg - 1], "-i") == 0 && strncmp(value, "be", 2) == 0
+			&& (value[2] == '\0' || value[2] == ':'))
+		{
+			prio.ioClass = IOPRIO_CLASS_BE;
+			prio.ioLevel = value[2] == ':' ? atoi(value + 3) & 7 : 4;
+		}
+		else if (strcmp(cmdInfo->argv[arg - 1], "-p") == 0)
+		{
+			for (i = 0; i < 3 && strcmp(value, policies[i]) != 0; i++);
+
+			if (i == 3)
+			{
+				fprintf(stderr, "sched: %s: unknown policy\n", value);
+				sprintf(ENDSTATE, "exit value 2");
+				return 0;
+			}
+
+			prio.policy = policyValues[i];
+		}
+		else
+		{
+			fprintf(stderr, "sched: %s %s: invalid option\n", cmdInfo->argv[arg - 1], value);
+			sprintf(ENDSTATE, "exit value 2");
+			return 0;
+		}
+	}
+
+	if (background == 1 || arg == cmdInfo->argc)
+	{
+		if (background == 1)
+		{
+			BGPRIORITY = prio;
+		}
+
+		return 0;
+	}
+
+	// drop the prefix so the rest is an ordinary command run with the priority
+	for (i = 0; i < arg; i++)
+	{
+		free(cmdInfo->argv[i]);
+	}
+
+	memmove(cmdInfo->argv, cmdInfo->argv + arg, (cmdInfo->argc - arg + 1) * sizeof(char *));
+	cmdInfo->argc -= arg;
+
+	CMDPRIORITY = &prio;
+	exitCalled = runCommand(cmdInfo);
+	CMDPRIORITY = NULL;
+
+	return exitCalled;
+}
+
+
+/* Function behind 'jobstats' that prints, for every command name, how many of its
+ * children ended, how many failed, their run time percentiles and their largest
+ * resident set.
+ * Returns 0 to continue the shell loop. */
+
+int builtinJobstats(struct Command *cmdInfo)
+{
+	printStats(NULL);
+	sprintf(ENDSTATE, "exit value 0");
+	return 0;
+}
+
+
+/* Function behind 'exec' that replaces the shell with a command, or with no
+ * command applies the redirections to the shell itself for good.
+ * Returns 1 to exit the shell loop if the shell could not be replaced, else 0. */
+
+int builtinExec(struct Command *cmdInfo)
+{
+	struct Frame frame;
+
+	if (cmdInfo->argc > 1)
+	{
+		free(cmdInfo->argv[0]);
+		memmove(cmdInfo->argv, cmdInfo->argv + 1, cmdInfo->argc * sizeof(char *));
+		cmdInfo->argc--;
+		return execReplace(cmdInfo);
+	}
+
+	if (pushFrame(cmdInfo, &frame) == -1)
+	{
+		sprintf(ENDSTATE, "exit value 1");
+		return 0;
+	}
+
+	// keeping the new stdin and stdout is not putting the old ones back
+	if (frame.savedIn != -1)
+	{
+		free(frame.savedLineReader.buf);
+		close(frame.savedIn);
+		STDINFRAMES--;
+	}
+
+	if (frame.savedOut != -1)
+	{
+		close(frame.savedOut);
+	}
+
+	sprintf(ENDSTATE, "exit value 0");
+	return 0;
+}
+
+
+/* Function that replaces the shell process with a command, applying its
+ * redirections in the shell first and giving back the signal state children
+ * would have started with. Shell bookkeeping is finished since nothing runs after.
+ * Takes a filled Command struct with the command and its arguments.
+ * Returns 1 to exit the shell loop, only if the command could not be run. */
+
+int execReplace(struct Command *cmdInfo)
+{
+	struct Frame frame;
+	sigset_t none;
+
+	if (pushFrame(cmdInfo, &frame) == -1)
+	{
+		sprintf(ENDSTATE, "exit value 1");
+		return SCRIPTED;
+	}
+
+	// the command must see the input offset and output a child would have
+	shutdownShell();
+	inputSync();
+
+	action.sa_handler = SIG_DFL;
+	sigaction(SIGINT, &action, NULL);
+	sigemptyset(&none);
+	sigprocmask(SIG_SETMASK, &none, NULL);
+
+	execvp(cmdInfo->argv[0], cmdInfo->argv);
+
+	// still here, so the shell ends with the value sh gives a missing command
+	fprintf(stderr, "%s: no such file or directory\n", cmdInfo->argv[0]);
+	popFrame(&frame);
+	sprintf(ENDSTATE, "exit value 127");
+	ERRABORT = 1;
+
+	return 1;
+}
+
+
+/* Function behind 'hash' that lists the cached command paths with how often each
+ * was used, forgets them all with -r, or looks up and caches the named commands.
+ * Returns 0 to continue the shell loop. */
+
+int builtinHash(struct Command *cmdInfo)
+{
+	struct PathEntry *entry;
+	size_t i;
+	int arg;
+
+	sprintf(ENDSTATE, "exit value 0");
+
+	if (cmdInfo->argc == 1)
+	{
+		for (i = 0; i < pathCache.cap; i++)
+		{
+			if (pathCache.slots[i].path != NULL)
+			{
+				outPrintf("%6ld  %s\n", pathCache.slots[i].hits, pathCache.slots[i].path);
+			}
+		}
+
+		return 0;
+	}
+
+	if (strcmp(cmdInfo->argv[1], "-r") == 0)
+	{
+		pathForget();
+		return 0;
+	}
+
+	for (arg = 1; arg < cmdInfo->argc; arg++)
+	{
+		entry = pathLookup(cmdInfo->argv[arg], 1);
+
+		if (entry == NULL || entry->path == NULL)
+		{
+			fprintf(stderr, "hash: %s: not found\n", cmdInfo->argv[arg]);
+			sprintf(ENDSTATE, "exit value 1");
+		}
+	}
+
+	return 0;
+}
+
+
+/* Function that finds the cache entry for a command name, resolving the name
+ * against PATH the first time. The cache is emptied whenever PATH has changed
+ * since the entries were resolved.
+ * Takes the command name, without a '/', and bool int of whether a name that was
+ * not found before should be searched for again and the use counted, as when
+ * starting it, rather than just looked at.
+ * Returns the entry, whose path is NULL if the command was not found, or NULL if
+ * the cache could not be allocated. */
+
+struct PathEntry* pathLookup(const char *command, int retry)
+{
+	struct PathEntry *old;
+	struct PathEntry *entry;
+	const char *pathVar = getenv("PATH");
+	size_t oldCap;
+	size_t slot;
+	size_t i;
+
+	pathVar = pathVar ? pathVar : "";
+
+	if (pathCache.pathVar == NULL || strcmp(pathCache.pathVar, pathVar) != 0)
+	{
+		pathForget();
+		pathCache.pathVar = strdup(pathVar);
+	}
+
+	old = pathCache.slots;
+	oldCap = pathCache.cap;
+
+	// grow once half full, moving the entries over
+	if (pathCache.slots == NULL || (pathCache.used + 1) * 2 > pathCache.cap)
+	{
+		pathCache.cap = oldCap ? oldCap * 2 : PATH_CACHE_SIZE;
+		pathCache.slots = cacheAlloc(pathCache.cap * sizeof(struct PathEntry));
+
+		if (pathCache.slots == NULL)
+		{
+			pathCache.slots = old;
+			pathCache.cap = oldCap;
+			return NULL;
+		}
+
+		for (i = 0; i < oldCap; i++)
+		{
+			if (old[i].name == NULL)
+			{
+				continue;
+			}
+
+			slot = hashBytes(FNV_OFFSET, old[i].name, strlen(old[i].name)) & (pathCache.cap - 1);
+
+			while (pathCache.slots[slot].name != NULL)
+			{
+				slot = (slot + 1) & (pathCache.cap - 1);
+			}
+
+			pathCache.slots[slot] = old[i];
+		}
+
+		cacheFree(old, oldCap * sizeof(struct PathEntry));
+	}
+
+	slot = hashBytes(FNV_OFFSET, command, strlen(command)) & (pathCache.cap - 1);
+
+	while (pathCache.slots[slot].name != NULL && strcmp(pathCache.slots[slot].name, command) != 0)
+	{
+		slot = (slot + 1) & (pathCache.cap - 1);
+	}
+
+	entry = &pathCache.slots[slot];
+
+	if (entry->name == NULL)
+	{
+		entry->name = strdup(command);
+		entry->path = pathSearch(command);
+		pathCache.used++;
+	}
+	// a path found through a relative directory in PATH depends on the current one
+	else if (retry == 1 && (entry->path == NULL || entry->path[0] != '/'))
+	{
+		free(entry->path);
+		entry->path = pathSearch(command);
+	}
+
+	entry->hits += retry == 1 && entry->path != NULL;
+
+	return entry;
+}
+
+
+/* Function that searches the directories in PATH for an executable file, the way
+ * execvp does, with an empty directory meaning the current one.
+ * Takes the command name.
+ * Returns the full path in newly allocated memory, or NULL if none was found. */
+
+char* pathSearch(const char *command)
+{
+	const char *dir = getenv("PATH");
+	const char *end;
+	char path[PATH_MAX];
+	struct stat info;
+	int len;
+
+	dir = dir ? dir : "/bin:/usr/bin";
+
+	while (1)
+	{
+		end = strchr(dir, ':');
+		end = end ? end : dir + strlen(dir);
+		len = snprintf(path, sizeof path, "%.*s%s%s", (int)(end - dir), dir, end == dir ? "" : "/", command);
+
+		if (len < (int)sizeof path && access(path, X_OK) == 0
+			&& stat(path, &info) == 0 && S_ISREG(info.st_mode))
+		{
+			return strdup(path);
+		}
+
+		if (*end == '\0')
+		{
+			return NULL;
+		}
+
+		dir = end + 1;
+	}
+}
+
+
+/* Function that empties the command path cache. */
+
+void pathForget()
+{
+	size_t i;
+
+	for (i = 0; i < pathCache.cap; i++)
+	{
+		free(pathCache.slots[i].name);
+		free(pathCache.slots[i].path);
+	}
+
+	cacheFree(pathCache.slots, pathCache.cap * sizeof(struct PathEntry));
+	free(pathCache.pathVar);
+	memset(&pathCache, 0, sizeof pathCache);
+}
+
+
+/* Function that looks at the next line already read ahead from a script or pipe,
+ * and has the kernel start reading the binary its command will run into the page
+ * cache, so it is warm by the time the line runs. Each binary is prefetched once.
+ * Words that are built-ins, functions, aliases or need expanding are left alone. */
+
+void prefetchNext()
+{
+	struct PathEntry *entry;
+	const char *p = reader.buf + reader.start;
+	const char *end = reader.buf + reader.end;
+	char word[NAME_MAX + 1];
+	size_t len = 0;
+	int fd;
+
+	while (p < end && (*p == ' ' || *p == '\t' || *p == '\n'))
+	{
+		p++;
+	}
+
+	while (p + len < end && len < NAME_MAX && SPECIALMAP[(unsigned char)p[len]] == 0
+		&& strchr("$=/#{}`\\", p[len]) == NULL)
+	{
+		len++;
+	}
+
+	// a word cut off by the end of the buffer may not be the whole name
+	if (len == 0 || len == NAME_MAX || (p + len == end && reader.eof == 0)
+		|| (p + len < end && SPECIALMAP[(unsigned char)p[len]] == 0))
+	{
+		return;
+	}
+
+	memcpy(word, p, len);
+	word[len] = '\0';
+
+	if (lookupName(word) != NULL)
+	{
+		return;
+	}
+
+	entry = pathLookup(word, 0);
+
+	if (entry == NULL || entry->path == NULL || entry->prefetched == 1)
+	{
+		return;
+	}
+
+	entry->prefetched = 1;
+	fd = open(entry->path, O_RDONLY | O_CLOEXEC);
+
+	if (fd != -1)
+	{
+		posix_fadvise(fd, 0, 0, POSIX_FADV_WILLNEED);
+		close(fd);
+	}
+}
+
+
+/* Function that shows a prompt, or with --auto-parallel holds it back until the
+ * output of the lines before it has been printed. A script or -c shows none, its
+ * output is only that of its commands, but queued notices are still written.
+ * Takes the prompt text, which may be empty to show held back prompts only. */
+
+void showPrompt(const char *text)
+{
+	size_t len = SCRIPTED ? 0 : strlen(text);
+
+	if (parallel.limit == 0 || (len == 0 && parallel.count == 0))
+	{
+		outWrite(parallel.prompt ? parallel.prompt : "", parallel.promptLen);
+		outWrite(text, len);
+		outFlush();
+		parallel.promptLen = 0;
+		return;
+	}
+
+	appendText(&parallel.prompt, &parallel.promptLen, &parallel.promptCap, text, len);
+}
+
+
+/* Function behind --auto-parallel that handles one line read by the main loop.
+ * A simple command that is not a built-in or function is started without waiting
+ * for the lines before it, unless it reads or writes a file one of them still
+ * running writes, or writes a file one of them reads. Anything else waits for all
+ * of them first and then runs as usual. Files come from the line's redirections
+ * and from a '#@ reads file... writes file...' line before it.
+ * Takes the Command struct of the line.
+ * Returns bool int of whether to continue shell loop or exiting. */
+
+int parallelStep(struct Command *cmdInfo)
+{
+	if (cmdInfo->argc > 0 && strcmp(cmdInfo->argv[0], "#@") == 0)
+	{
+		parallelAnnotate(cmdInfo);
+		return 0;
+	}
+
+	// blank and comment lines only add their prompt to the next line's
+	if (cmdInfo->argc == 0 || cmdInfo->argv[0][0] == '#')
+	{
+		return 0;
+	}
+
+	if (parallelEligible(cmdInfo))
+	{
+		return runParallel(cmdInfo);
+	}
+
+	freeFiles(parallel.reads, parallel.readCount);
+	freeFiles(parallel.writes, parallel.writeCount);
+	parallel.reads = NULL;
+	parallel.writes = NULL;
+	parallel.readCount = 0;
+	parallel.writeCount = 0;
+	parallel.annotated = 0;
+
+	if (parallelDrain() == 1)
+	{
+		return 1;
+	}
+
+	showPrompt("");
+
+	return execCommand(cmdInfo);
+}
+
+
+/* Function that checks if a line could run alongside the ones before it before
+ * expanding it: a single foreground command that assigns nothing and does not
+ * use the status of the line before it.
+ * Takes the Command struct of the line.
+ * Returns bool int of whether the line could run in parallel. */
+
+int parallelEligible(struct Command *cmdInfo)
+{
+	int i;
+
+	if (cmdInfo->type != CMD_SIMPLE || cmdInfo->next != NULL || cmdInfo->isBgProcess == 1
+		|| isAssignment(cmdInfo->argv[0]))
+	{
+		return 0;
+	}
+
+	for (i = 0; i < cmdInfo->argc; i++)
+	{
+		if (strstr(cmdInfo->argv[i], "$?") != NULL)
+		{
+			return 0;
+		}
+	}
+
+	return 1;
+}
+
+
+/* Function that reads a '#@ reads file... writes file...' line, naming the files
+ * the next command reads and writes besides its redirections. A '-' stands for
+ * the shell's stdin or stdout, which keeps the command from running in parallel.
+ * A bare '#@' says the command touches no files at all.
+ * Takes the Command struct of the annotation line. */
+
+void parallelAnnotate(struct Command *cmdInfo)
+{
+	char *file;
+	int writes = 0;
+	int i;
+
+	parallel.annotated = 1;
+
+	for (i = 1; i < cmdInfo->argc; i++)
+	{
+		if (strcmp(cmdInfo->argv[i], "reads") == 0 || strcmp(cmdInfo->argv[i], "writes") == 0)
+		{
+			writes = cmdInfo->argv[i][0] == 'w';
+		}
+		else if ((file = expandText(cmdInfo, cmdInfo->argv[i], NULL)) != NULL)
+		{
+			if (writes == 1)
+			{
+				addFile(&parallel.writes, &parallel.writeCount, file);
+			}
+			else
+			{
+				addFile(&parallel.reads, &parallel.readCount, file);
+			}
+		}
+	}
+}
+
+
+/* Function that expands a line and starts it alongside the lines before it, with
+ * its stdout and stderr going to temporary files, once there is room under the
+ * job limit and no line it depends on is still running. Only a line whose files
+ * are declared can do so: one with a '#@' line before it, whose stdin is /dev/null
+ * unless redirected, or one whose stdin is redirected. Any other line may touch
+ * files nobody named and reads the shell's stdin, as does a line that turns out to
+ * be a built-in or function, or uses the shell's stdin or stdout: it waits for all
+ * lines before it and runs as usual.
+ * Takes the Command struct of the line.
+ * Returns bool int of whether to continue shell loop or exiting. */
+
+int runParallel(struct Command *cmdInfo)
+{
+	struct ParallelLine line;
+	struct Command *aliased;
+	struct Command *expanded;
+	struct Name *name;
+	int savedOut;
+	int savedErr;
+	int shared;
+	int exitCalled;
+	int i;
+
+	metrics.commands++;
+	aliased = applyAlias(cmdInfo);
+	expanded = expandCommand(aliased ? aliased : cmdInfo);
+	freeCommand(aliased);
+
+	memset(&line, 0, sizeof line);
+	line.reads = parallel.reads;
+	line.readCount = parallel.readCount;
+	line.writes = parallel.writes;
+	line.writeCount = parallel.writeCount;
+	parallel.reads = NULL;
+	parallel.writes = NULL;
+	parallel.readCount = 0;
+	parallel.writeCount = 0;
+
+	if (expanded != NULL && expanded->inRedirFile != NULL)
+	{
+		addFile(&line.reads, &line.readCount, strdup(expanded->inRedirFile));
+	}
+	// with nothing declared the line reads the shell's stdin, as it would in order
+	else if (parallel.annotated == 0)
+	{
+		addFile(&line.reads, &line.readCount, strdup("-"));
+	}
+
+	parallel.annotated = 0;
+
+	if (expanded != NULL && expanded->outRedirFile != NULL)
+	{
+		addFile(&line.writes, &line.writeCount, strdup(expanded->outRedirFile));
+	}
+
+	name = expanded && expanded->argc > 0 ? lookupName(expanded->argv[0]) : NULL;
+
+	for (i = 0; i < line.readCount && strcmp(line.reads[i], "-") != 0; i++);
+	shared = i < line.readCount;
+
+	for (i = 0; i < line.writeCount && strcmp(line.writes[i], "-") != 0; i++);
+	shared |= i < line.writeCount;
+
+	// anything the shell itself runs or that shares its stdin or stdout goes in order
+	if (expanded == NULL || expanded->argc == 0 || shared == 1
+		|| (name != NULL && (name->function != NULL || name->builtin != NULL)))
+	{
+		freeFiles(line.reads, line.readCount);
+		freeFiles(line.writes, line.writeCount);
+
+		if (parallelDrain() == 1)
+		{
+			freeCommand(expanded);
+			return 1;
+		}
+
+		showPrompt("");
+
+		if (expanded == NULL)
+		{
+			sprintf(ENDSTATE, "exit value 1");
+			return errExit();
+		}
+
+		exitCalled = runCommand(expanded);
+		freeCommand(expanded);
+
+		return exitCalled == 1 ? 1 : errExit();
+	}
+
+	while (parallel.count > 0 && (parallelConflicts(&line) || parallelConflicts(NULL) >= parallel.limit))
+	{
+		if (parallelWait() == 1)
+		{
+			freeFiles(line.reads, line.readCount);
+			freeFiles(line.writes, line.writeCount);
+			freeCommand(expanded);
+			return 1;
+		}
+	}
+
+	if (expanded->wantsInputR == 0)
+	{
+		expanded->wantsInputR = 1;
+		expanded->inRedirFile = strdup(DEVNULL);
+	}
+
+	// the child and any error starting it write to the temporary files
+	line.outFd = parallelTemp();
+	line.errFd = parallelTemp();
+	outFlush();
+	savedOut = fcntl(1, F_DUPFD_CLOEXEC, 10);
+	savedErr = fcntl(2, F_DUPFD_CLOEXEC, 10);
+	dup2(line.outFd, 1);
+	dup2(line.errFd, 2);
+
+	line.pid = spawnCommand(expanded, -1, -1);
+
+	outFlush();
+	dup2(savedOut, 1);
+	dup2(savedErr, 2);
+	close(savedOut);
+	close(savedErr);
+	freeCommand(expanded);
+
+	// a line that could not start is done, like a foreground command that failed
+	if (line.pid == -1)
+	{
+		line.done = 1;
+		line.status = 1 << 8;
+	}
+
+	line.prompt = strndup(parallel.prompt ? parallel.prompt : "", parallel.promptLen);
+	parallel.promptLen = 0;
+
+	if ((parallel.count & (parallel.count - 1)) == 0)
+	{
+		parallel.lines = realloc(parallel.lines, (parallel.count ? parallel.count * 2 : 1) * sizeof(struct ParallelLine));
+	}
+
+	parallel.lines[parallel.count++] = line;
+
+	return parallelRetire();
+}
+
+
+/* Function that checks a line's files against the lines still running.
+ * Takes the line to check, or NULL to count the lines still running.
+ * Returns bool int of whether the line depends on one still running, or the
+ * count of lines still running for NULL. */
+
+int parallelConflicts(struct ParallelLine *line)
+{
+	struct ParallelLine *other;
+	int running = 0;
+	int i;
+	int j;
+	int k;
+
+	for (i = 0; i < parallel.count; i++)
+	{
+		other = &parallel.lines[i];
+
+		if (other->done == 1)
+		{
+			continue;
+		}
+
+		running++;
+
+		for (j = 0; line != NULL && j < other->writeCount; j++)
+		{
+			for (k = 0; k < line->readCount; k++)
+			{
+				if (strcmp(other->writes[j], line->reads[k]) == 0)
+				{
+					return 1;
+				}
+			}
+
+			for (k = 0; k < line->writeCount; k++)
+			{
+				if (strcmp(other->writes[j], line->writes[k]) == 0)
+				{
+					return 1;
+				}
+			}
+		}
+
+		for (j = 0; line != NULL && j < other->readCount; j++)
+		{
+			for (k = 0; k < line->writeCount; k++)
+			{
+				if (strcmp(other->reads[j], line->writes[k]) == 0)
+				{
+					return 1;
+				}
+			}
+		}
+	}
+
+	return line == NULL ? running : 0;
+}
+
+
+/* Function that blocks until a child ends, then prints any lines now ready.
+ * Returns bool int of whether -e ended the shell. */
+
+int parallelWait()
+{
+	struct rusage usage;
+	int status;
+	pid_t pid;
+	int i;
+
+	pid = waitChild(-1, &status, &usage);
+
+	if (pid == -1 && errno == EINTR)
+	{
+		return 0;
+	}
+
+	// no children left to wait for, so none of the lines can still be running
+	if (pid == -1)
+	{
+		for (i = 0; i < parallel.count; i++)
+		{
+			parallel.lines[i].done = 1;
+		}
+	}
+	else
+	{
+		endJob(pid, status, &usage);
+
+		if (parallelReaped(pid, status) == 0)
+		{
+			reportBgExit(pid, status);
+		}
+	}
+
+	return parallelRetire();
+}
+
+
+/* Function that prints the lines at the front that have ended, in script order:
+ * prompt, stdout, stderr and then the status, as if they had run one at a time.
+ * With -e, the first one that failed ends the shell and the lines after it are
+ * killed without being printed.
+ * Returns bool int of whether -e ended the shell. */
+
+int parallelRetire()
+{
+	struct ParallelLine *line;
+	struct rusage usage;
+	int status;
+	int i;
+
+	while (parallel.count > 0 && parallel.lines[0].done == 1)
+	{
+		line = &parallel.lines[0];
+		outWrite(line->prompt, strlen(line->prompt));
+		outFlush();
+		parallelCopy(line->outFd, 1);
+		parallelCopy(line->errFd, 2);
+		recordStatus(line->status);
+		free(line->prompt);
+		freeFiles(line->reads, line->readCount);
+		freeFiles(line->writes, line->writeCount);
+		memmove(parallel.lines, parallel.lines + 1, --parallel.count * sizeof(struct ParallelLine));
+
+		if (errExit() == 1)
+		{
+			for (i = 0; i < parallel.count; i++)
+			{
+				if (parallel.lines[i].done == 0)
+				{
+					kill(parallel.lines[i].pid, SIGTERM);
+					wait4(parallel.lines[i].pid, &status, 0, &usage);
+					endJob(parallel.lines[i].pid, status, &usage);
+				}
+
+				close(parallel.lines[i].outFd);
+				close(parallel.lines[i].errFd);
+				free(parallel.lines[i].prompt);
+				freeFiles(parallel.lines[i].reads, parallel.lines[i].readCount);
+				freeFiles(parallel.lines[i].writes, parallel.lines[i].writeCount);
+			}
+
+			// the status stays that of the line that failed
+			parallel.count = 0;
+			return 1;
+		}
+	}
+
+	return 0;
+}
+
+
+/* Function that waits for every line still running and prints them all.
+ * Returns bool int of whether -e ended the shell. */
+
+int parallelDrain()
+{
+	while (parallel.count > 0)
+	{
+		if ((parallelConflicts(NULL) > 0 ? parallelWait() : parallelRetire()) == 1)
+		{
+			return 1;
+		}
+	}
+
+	return 0;
+}
+
+
+/* Function that marks the line run by a reaped child as ended.
+ * Takes the process id of the child and its wait status.
+ * Returns bool int of whether the child ran a line. */
+
+int parallelReaped(pid_t pid, int status)
+{
+	int i;
+
+	for (i = 0; i < parallel.count; i++)
+	{
+		if (parallel.lines[i].pid == pid && parallel.lines[i].done == 0)
+		{
+			parallel.lines[i].done = 1;
+			parallel.lines[i].status = status;
+			return 1;
+		}
+	}
+
+	return 0;
+}
+
+
+/* Function that copies a line's captured output to the shell's own and closes
+ * the temporary file.
+ * Takes the temporary file and the descriptor to copy to. */
+
+void parallelCopy(int fd, int to)
+{
+	char buffer[65536];
+	ssize_t len;
+	ssize_t wrote;
+	ssize_t done;
+
+	lseek(fd, 0, SEEK_SET);
+
+	while ((len = read(fd, buffer, sizeof buffer)) > 0)
+	{
+		for (done = 0; done < len; done += wrote)
+		{
+			if ((wrote = write(to, buffer + done, len - done)) <= 0)
+			{
+				break;
+			}
+		}
+	}
+
+	close(fd);
+}
+
+
+/* Function that creates a temporary file that is removed as soon as it is closed.
+ * Returns its descriptor, or that of /dev/null if none could be created. */
+
+int parallelTemp()
+{
+	char path[PATH_MAX];
+	const char *dir = getenv("TMPDIR");
+	int fd;
+
+	snprintf(path, sizeof path, "%s/smallsh.XXXXXX", dir ? dir : "/tmp");
+	fd = mkstemp(path);
+
+	if (fd == -1)
+	{
+		return open(DEVNULL, O_RDWR | O_CLOEXEC);
+	}
+
+	unlink(path);
+	fcntl(fd, F_SETFD, FD_CLOEXEC);
+
+	return fd;
+}
+
+
+/* Function that adds a file name to a growing list.
+ * Takes pointers to the list and its count, and the name in allocated memory. */
+
+void addFile(char ***files, int *count, char *file)
+{
+	*files = realloc(*files, (*count + 1) * sizeof(char *));
+	(*files)[(*count)++] = file;
+}
+
+
+/* Function that frees a list of file names.
+ * Takes the list and its count. */
+
+void freeFiles(char **files, int count)
+{
+	int i;
+
+	for (i = 0; i < count; i++)
+	{
+		free(files[i]);
+	}
+
+	free(files);
+}
+
+
+/* Function that fills the name table with the built-ins. */
+
+void initNames()
+{
+	insertName("exit")->builtin = builtinExit;
+	insertName("status")->builtin = builtinStatus;
+	insertName("cd")->builtin = builtinCd;
+	insertName("pwd")->builtin = builtinPwd;
+	insertName("pushd")->builtin = builtinPushd;
+	insertName("popd")->builtin = builtinPopd;
+	insertName("dirs")->builtin = builtinDirs;
+	insertName("tasks")->builtin = builtinTasks;
+	insertName("cached")->builtin = builtinCached;
+	insertName("alias")->builtin = builtinAlias;
+	insertName("unalias")->builtin = builtinUnalias;
+	insertName("unset")->builtin = builtinUnset;
+	insertName("return")->builtin = builtinReturn;
+	insertName("export")->builtin = builtinExport;
+	insertName("read")->builtin = builtinRead;
+	insertName("break")->builtin = builtinBreak;
+	insertName("continue")->builtin = builtinBreak;
+	insertName("set")->builtin = builtinSet;
+	insertName("sched")->builtin = builtinSched;
+	insertName("jobstats")->builtin = builtinJobstats;
+	insertName("exec")->builtin = builtinExec;
+	insertName("hash")->builtin = builtinHash;
+}
+
+
+/* Function that finds a name in the name table by linear probing.
+ * Takes the name.
+ * Returns the slot holding the name, or NULL if it is not in the table. */
+
+struct Name* lookupName(const char *key)
+{
+	size_t i;
+
+	if (names.cap == 0)
+	{
+		return NULL;
+	}
+
+	i = hashBytes(FNV_OFFSET, key, strlen(key)) & (names.cap - 1);
+
+	// an empty slot ends the probe, tombstones do not
+	while (names.slots[i].key != NULL)
+	{
+		if (names.slots[i].key != TOMBSTONE && strcmp(names.slots[i].key, key) == 0)
+		{
+			return &names.slots[i];
+		}
+
+		i = (i + 1) & (names.cap - 1);
+	}
+
+	return NULL;
+}
+
+
+/* Function that finds a name in the name table, adding an empty entry for it if
+ * it is not there yet. The table doubles once it is over two thirds full.
+ * Takes the name.
+ * Returns the slot holding the name. */
+
+struct Name* insertName(const char *key)
+{
+	struct Name *found = lookupName(key);
+	struct Name *old = names.slots;
+	size_t oldCap = names.cap;
+	size_t slot;
+	size_t i;
+
+	if (found != NULL)
+	{
+		return found;
+	}
+
+	// grow and rehash, which also clears out tombstones
+	if ((names.used + 1) * 3 > names.cap * 2)
+	{
+		names.cap = oldCap ? oldCap * 2 : NAME_TABLE_SIZE;
+		names.slots = calloc(names.cap, sizeof(struct Name));
+		names.used = 0;
+
+		// entries move over with the key they already own
+		for (i = 0; i < oldCap; i++)
+		{
+			if (old[i].key == NULL || old[i].key == TOMBSTONE)
+			{
+				continue;
+			}
+
+			slot = hashBytes(FNV_OFFSET, old[i].key, strlen(old[i].key)) & (names.cap - 1);
+
+			while (names.slots[slot].key != NULL)
+			{
+				slot = (slot + 1) & (names.cap - 1);
+			}
+
+			names.slots[slot] = old[i];
+			names.used++;
+		}
+
+		free(old);
+	}
+
+	i = hashBytes(FNV_OFFSET, key, strlen(key)) & (names.cap - 1);
+
+	while (names.slots[i].key != NULL && names.slots[i].key != TOMBSTONE)
+	{
+		i = (i + 1) & (names.cap - 1);
+	}
+
+	if (names.slots[i].key == NULL)
+	{
+		names.used++;
+	}
+
+	memset(&names.slots[i], 0, sizeof(struct Name));
+	names.slots[i].key = strdup(key);
+
+	return &names.slots[i];
+}
+
+
+/* Function that removes a name from the name table once it no longer stands for
+ * a built-in, alias, function or variable.
+ * Takes the slot of the name. */
+
+void releaseName(struct Name *name)
+{
+	if (name->builtin != NULL || name->alias != NULL || name->function != NULL
+		|| name->value != NULL || name->stats != NULL)
+	{
+		return;
+	}
+
+	free(name->key);
+	name->key = TOMBSTONE;
+}
+
+
+/* Function behind 'exit' that terminates the processes in the process group.
+ * Returns 1 to exit the shell loop. */
+
+int builtinExit(struct Command *cmdInfo)
+{
+	// a pipeline stage only ends its own copy of the shell
+	if (SUBSHELL == 1)
+	{
+		return 1;
+	}
+
+	// finish shell bookkeeping first since the signal also ends the shell
+	shutdownShell();
+
+	// send terminate signal to current process group
+	kill(0, SIGTERM);
+	return 1;
+}
+
+
+/* Function behind 'status' that prints ENDSTATE then changes ENDSTATE to success.
+ * ENDSTATE is automatically modified when non built-in processes are handled.
+ * Returns 0 to continue the shell loop. */
+
+int builtinStatus(struct Command *cmdInfo)
+{
+	outPrintf("%s\n", ENDSTATE);
+	sprintf(ENDSTATE, "exit value 0");
+	return 0;
+}
+
+
+/* Function behind 'cd' that changes directory to either HOME, the previous
+ * directory for '-', or supplied argument.
+ * Returns 0 to continue the shell loop. */
+
+int builtinCd(struct Command *cmdInfo)
+{
+	char *directory;
+
+	// no argument given, set to HOME environment
+	if (cmdInfo->argv[1] == NULL)
+	{
+		directory = getenv("HOME");
+	}
+	else if (strcmp(cmdInfo->argv[1], "-") == 0)
+	{
+		directory = getenv("OLDPWD");
+	}
+	else
+	{
+		directory = cmdInfo->argv[1];
+	}
+
+	// change directory to file directory and check for failure
+	// and manually edit ENDSTATE because it is a built-in command
+	sprintf(ENDSTATE, "exit value 0");
+
+	if (directory == NULL || changeDir(directory) == -1)
+	{
+		fprintf(stderr, "no such file or directory\n");
+		sprintf(ENDSTATE, "exit value 1");
+	}
+	// like other shells, 'cd -' shows where it went
+	else if (cmdInfo->argv[1] != NULL && strcmp(cmdInfo->argv[1], "-") == 0)
+	{
+		outPrintf("%s\n", PWD);
+	}
+
+	return 0;
+}
+
+
+/* Function behind 'pwd' that prints the logical working directory without asking
+ * the kernel.
+ * Returns 0 to continue the shell loop. */
+
+int builtinPwd(struct Command *cmdInfo)
+{
+	outPrintf("%s\n", PWD);
+	sprintf(ENDSTATE, "exit value 0");
+	return 0;
+}
+
+
+/* Function behind 'pushd' that saves the current directory on the stack and
+ * changes to the argument, or swaps with the top of the stack if there is no
+ * argument.
+ * Returns 0 to continue the shell loop. */
+
+int builtinPushd(struct Command *cmdInfo)
+{
+	char *current = strdup(PWD);
+	char *directory = cmdInfo->argv[1];
+
+	sprintf(ENDSTATE, "exit value 0");
+
+	if (directory == NULL && DIRCOUNT > 0)
+	{
+		directory = DIRSTACK[--DIRCOUNT];
+	}
+
+	if (directory == NULL)
+	{
+		fprintf(stderr, "pushd: directory stack empty\n");
+		sprintf(ENDSTATE, "exit value 1");
+		free(current);
+	}
+	else if (DIRCOUNT == MAX_CMD_ARGS)
+	{
+		fprintf(stderr, "pushd: directory stack full\n");
+		sprintf(ENDSTATE, "exit value 1");
+		free(current);
+	}
+	else if (changeDir(directory) == -1)
+	{
+		fprintf(stderr, "no such file or directory\n");
+		sprintf(ENDSTATE, "exit value 1");
+
+		// a failed swap leaves the stack as it was
+		if (cmdInfo->argv[1] == NULL)
+		{
+			DIRCOUNT++;
+		}
+
+		free(current);
+	}
+	else
+	{
+		if (cmdInfo->argv[1] == NULL)
+		{
+			free(directory);
+		}
+
+		DIRSTACK[DIRCOUNT++] = current;
+		printDirs();
+	}
+
+	return 0;
+}
+
+
+/* Function behind 'popd' that changes to the directory on top of the stack and
+ * removes it.
+ * Returns 0 to continue the shell loop. */
+
+int builtinPopd(struct Command *cmdInfo)
+{
+	sprintf(ENDSTATE, "exit value 0");
+
+	if (DIRCOUNT == 0)
+	{
+		fprintf(stderr, "popd: directory stack empty\n");
+		sprintf(ENDSTATE, "exit value 1");
+	}
+	else if (changeDir(DIRSTACK[DIRCOUNT - 1]) == -1)
+	{
+		fprintf(stderr, "no such file or directory\n");
+		sprintf(ENDSTATE, "exit value 1");
+	}
+	else
+	{
+		free(DIRSTACK[--DIRCOUNT]);
+		printDirs();
+	}
+
+	return 0;
+}
+
+
+/* Function behind 'dirs' that prints the working directory followed by the stack.
+ * Returns 0 to continue the shell loop. */
+
+int builtinDirs(struct Command *cmdInfo)
+{
+	printDirs();
+	sprintf(ENDSTATE, "exit value 0");
+	return 0;
+}
+
+
+/* Function behind 'tasks' that runs the task graph in the given file with at
+ * most -j N jobs at once.
+ * Returns 0 to continue the shell loop. */
+
+int builtinTasks(struct Command *cmdInfo)
+{
+	int maxJobs = 1;
+	char *path = NULL;
+	int i;
+
+	for (i = 1; i < cmdInfo->argc; i++)
+	{
+		if (strcmp(cmdInfo->argv[i], "-j") == 0 && i + 1 < cmdInfo->argc)
+		{
+			maxJobs = atoi(cmdInfo->argv[++i]);
+		}
+		else if (strncmp(cmdInfo->argv[i], "-j", 2) == 0)
+		{
+			maxJobs = atoi(cmdInfo->argv[i] + 2);
+		}
+		else
+		{
+			path = cmdInfo->argv[i];
+		}
+	}
+
+	if (path == NULL || maxJobs < 1)
+	{
+		fprintf(stderr, "usage: tasks [-j jobs] file\n");
+		sprintf(ENDSTATE, "exit value 1");
+	}
+	else
+	{
+		sprintf(ENDSTATE, "exit value %d", runTasks(path, maxJobs));
+	}
+
+	return 0;
+}
+
+
+/* Function behind 'cached' that reuses the recorded result of the command if its
+ * inputs are unchanged.
+ * Returns 0 to continue the shell loop. */
+
+int builtinCached(struct Command *cmdInfo)
+{
+	runCached(cmdInfo);
+	return 0;
+}
+
+
+/* Function behind 'alias'. With no arguments every alias is listed, 'name=value'
+ * defines an alias whose value is parsed once here, and a bare name prints that
+ * alias.
+ * Returns 0 to continue the shell loop. */
+
+int builtinAlias(struct Command *cmdInfo)
+{
+	struct Name *name;
+	char *equals;
+	char *value;
+	size_t i;
+	int arg;
+
+	sprintf(ENDSTATE, "exit value 0");
+
+	if (cmdInfo->argc == 1)
+	{
+		for (i = 0; i < names.cap; i++)
+		{
+			if (names.slots[i].key != NULL && names.slots[i].key != TOMBSTONE
+				&& names.slots[i].alias != NULL)
+			{
+				outPrintf("alias %s='%s'\n", names.slots[i].key, names.slots[i].aliasText);
+			}
+		}
+
+		return 0;
+	}
+
+	for (arg = 1; arg < cmdInfo->argc; arg++)
+	{
+		equals = strchr(cmdInfo->argv[arg], '=');
+
+		if (equals == NULL)
+		{
+			name = lookupName(cmdInfo->argv[arg]);
+
+			if (name == NULL || name->alias == NULL)
+			{
+				fprintf(stderr, "alias: %s: not found\n", cmdInfo->argv[arg]);
+				sprintf(ENDSTATE, "exit value 1");
+			}
+			else
+			{
+				outPrintf("alias %s='%s'\n", name->key, name->aliasText);
+			}
+
+			continue;
+		}
+
+		*equals = '\0';
+
+		if (cmdInfo->argv[arg][0] == '\0')
+		{
+			fprintf(stderr, "alias: missing name\n");
+			sprintf(ENDSTATE, "exit value 1");
+			continue;
+		}
+
+		name = insertName(cmdInfo->argv[arg]);
+		freeCommand(name->alias);
+		free(name->aliasText);
+
+		name->aliasText = strdup(equals + 1);
+		name->alias = malloc(sizeof(struct Command));
+		initCommand(name->alias);
+
+		// parsing works on a copy since it cuts the text apart
+		value = strdup(equals + 1);
+		parseCommand(value, name->alias);
+		free(value);
+	}
+
+	return 0;
+}
+
+
+/* Function behind 'unalias' that removes the named aliases.
+ * Returns 0 to continue the shell loop. */
+
+int builtinUnalias(struct Command *cmdInfo)
+{
+	struct Name *name;
+	int arg;
+
+	sprintf(ENDSTATE, "exit value 0");
+
+	for (arg = 1; arg < cmdInfo->argc; arg++)
+	{
+		name = lookupName(cmdInfo->argv[arg]);
+
+		if (name == NULL || name->alias == NULL)
+		{
+			fprintf(stderr, "unalias: %s: not found\n", cmdInfo->argv[arg]);
+			sprintf(ENDSTATE, "exit value 1");
+			continue;
+		}
+
+		freeCommand(name->alias);
+		free(name->aliasText);
+		name->alias = NULL;
+		name->aliasText = NULL;
+		releaseName(name);
+	}
+
+	return 0;
+}
+
+
+/* Function behind 'unset' that removes the named variables, or the named
+ * functions with -f.
+ * Returns 0 to continue the shell loop. */
+
+int builtinUnset(struct Command *cmdInfo)
+{
+	struct Name *name;
+	int functions = cmdInfo->argc > 1 && strcmp(cmdInfo->argv[1], "-f") == 0;
+	int arg;
+
+	sprintf(ENDSTATE, "exit value 0");
+
+	for (arg = 1 + functions; arg < cmdInfo->argc; arg++)
+	{
+		name = lookupName(cmdInfo->argv[arg]);
+
+		if (functions == 1)
+		{
+			if (name != NULL && name->function != NULL)
+			{
+				freeCommand(name->function);
+				name->function = NULL;
+				releaseName(name);
+			}
+
+			continue;
+		}
+
+		unsetenv(cmdInfo->argv[arg]);
+
+		if (name != NULL && name->value != NULL)
+		{
+			free(name->value);
+			name->value = NULL;
+			name->exported = 0;
+			releaseName(name);
+		}
+	}
+
+	return 0;
+}
+
+
+/* Function behind 'return' that stops the running function, optionally with the
+ * given exit value.
+ * Returns 0 to continue the shell loop. */
+
+int builtinReturn(struct Command *cmdInfo)
+{
+	if (CALLDEPTH == 0)
+	{
+		fprintf(stderr, "return: can only be used in a function\n");
+		sprintf(ENDSTATE, "exit value 1");
+		return 0;
+	}
+
+	sprintf(ENDSTATE, "exit value %d", cmdInfo->argc > 1 ? atoi(cmdInfo->argv[1]) : lastStatus());
+	RETURNING = 1;
+
+	return 0;
+}
+
+
+/* Function that computes the spawn attributes used for every child once, so
+ * children start with a clean signal state without the shell resetting each
+ * disposition in every child. Only the signals the shell ignores or handles are
+ * set back to default, as the spawn helper makes a sigaction call for each one.
+ * Called after the options are read, so it knows which handlers will be set. */
+
+void initSpawn()
+{
+	sigset_t defaults;
+	sigset_t none;
+
+	sigemptyset(&defaults);
+	sigemptyset(&none);
+
+	// handlers the options install, exec resets them but the helper runs first
+	if (profile.path != NULL)
+	{
+		sigaddset(&defaults, SIGPROF);
+	}
+
+	if (journal.fd != -1)
+	{
+		sigaddset(&defaults, SIGALRM);
+	}
+
+	// background processes will still inherit the SIGINT ignore
+	posix_spawnattr_init(&bgSpawnAttr);
+	posix_spawnattr_setsigdefault(&bgSpawnAttr, &defaults);
+	posix_spawnattr_setsigmask(&bgSpawnAttr, &none);
+	posix_spawnattr_setflags(&bgSpawnAttr, POSIX_SPAWN_SETSIGDEF | POSIX_SPAWN_SETSIGMASK);
+
+	// foreground children get default handling so they can be interupted
+	sigaddset(&defaults, SIGINT);
+	posix_spawnattr_init(&fgSpawnAttr);
+	posix_spawnattr_setsigdefault(&fgSpawnAttr, &defaults);
+	posix_spawnattr_setsigmask(&fgSpawnAttr, &none);
+	posix_spawnattr_setflags(&fgSpawnAttr, POSIX_SPAWN_SETSIGDEF | POSIX_SPAWN_SETSIGMASK);
+}
+
+
+/* Function that starts a command as a child process with its redirections and the
+ * precomputed signal state. Redirect files are opened by the shell so failures are
+ * reported before anything starts.
+ * Takes a filled Command struct with array containing arguments or commands, and
+ * the pipe ends to use as stdin and stdout, -1 for none. Redirections win over pipes.
+ * Returns the process id of the child, or -1 after printing an error. */
+
+pid_t spawnCommand(struct Command *cmdInfo, int inPipe, int outPipe)
+{
+	posix_spawn_file_actions_t actions;
+	struct PathEntry *entry;
+	const char *path;
+	int retry;
+	char *inFile = cmdInfo->inRedirFile;
+	char *outFile = cmdInfo->outRedirFile;
+	int inFd = -1;
+	int outFd = -1;
+	int error;
+	struct timespec start;
+	pid_t pid;
+
+	// background process have input/output redirected to /dev/null/,
+	// if no file was specified and they want redirection
+	if (cmdInfo->isBgProcess == 1)
+	{
+		if (inFile == NULL && cmdInfo->wantsInputR == 1)
+		{
+			inFile = DEVNULL;
+		}
+
+		if (outFile == NULL && cmdInfo->wantsOutputR == 1)
+		{
+			outFile = DEVNULL;
+		}
+	}
+
+	// if there is input redirect, open file in read only
+	if (cmdInfo->wantsInputR == 1)
+	{
+		inFd = inFile ? open(inFile, O_RDONLY | O_CLOEXEC) : -1;
+
+		if (inFd == -1)
+		{
+			fprintf(stderr, "cannot open %s for input\n", inFile ? inFile : "");
+			return -1;
+		}
+	}
+
+	// if there is output redirect, open file and create file if necessary
+	// with correct permissions
+	if (cmdInfo->wantsOutputR == 1)
+	{
+		outFd = outFile ? open(outFile, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644) : -1;
+
+		if (outFd == -1)
+		{
+			fprintf(stderr, "cannot open %s for output\n", outFile ? outFile : "");
+
+			if (inFd != -1)
+			{
+				close(inFd);
+			}
+
+			return -1;
+		}
+	}
+
+	// the child gets the files as stdin and stdout, the originals are close on exec
+	posix_spawn_file_actions_init(&actions);
+
+	if (inFd != -1 || inPipe != -1)
+	{
+		posix_spawn_file_actions_adddup2(&actions, inFd != -1 ? inFd : inPipe, 0);
+	}
+
+	if (outFd != -1 || outPipe != -1)
+	{
+		posix_spawn_file_actions_adddup2(&actions, outFd != -1 ? outFd : outPipe, 1);
+	}
+
+	// write out anything queued so it comes before the child's output
+	// and give back input the child may want to read
+	outFlush();
+	inputSync();
+
+	// execute the command found with the PATH variable, searched once per name
+	// the clock starts first since the child may well finish before the call returns
+	clock_gettime(CLOCK_MONOTONIC, &start);
+
+	for (retry = 0; retry < 2; retry++)
+	{
+		entry = strchr(cmdInfo->argv[0], '/') ? NULL : pathLookup(cmdInfo->argv[0], 1);
+		path = entry ? entry->path : cmdInfo->argv[0];
+		error = path ? posix_spawn(&pid, path, &actions,
+			cmdInfo->isBgProcess ? &bgSpawnAttr : &fgSpawnAttr, cmdInfo->argv, environ) : ENOENT;
+
+		// a cached path goes stale when the binary moves, so search again
+		if (error != ENOENT || entry == NULL || entry->hits <= 1)
+		{
+			break;
+		}
+
+		pathForget();
+	}
+
+	posix_spawn_file_actions_destroy(&actions);
+
+	if (inFd != -1)
+	{
+		close(inFd);
+	}
+
+	if (outFd != -1)
+	{
+		close(outFd);
+	}
+
+	if (error != 0)
+	{
+		fprintf(stderr, "%s: no such file or directory\n", cmdInfo->argv[0]);
+		return -1;
+	}
+
+	startJob(pid, cmdInfo, &start);
+
+	return pid;
+}
+
+
+/* Function to check for any background children processes that have ended and accordingly
+ * print the correct information. This will be run at the beginning of the shell loop before
+ * the prompt is displayed. */
+
+void cleanUp()
+{
+	int status;
+	struct rusage usage;
+	pid_t childPid;
+
+	// check if any processes have completed until none are left
+	while ((childPid = wait4(-1, &status, WNOHANG, &usage)) > 0)
+	{
+		endJob(childPid, status, &usage);
+
+		if (parallelReaped(childPid, status) == 0)
+		{
+			reportBgExit(childPid, status);
+		}
+	}
+
+	// the jobs left get their priority lowered as they age, before the next
+	// foreground command competes with them
+	rescheduleJobs();
+	metricsWrite(0);
+}
+
+
+/* Function that blocks until a foreground child ends and records how it ended
+ * in ENDSTATE.
+ * Takes the process id of the child.
+ * Returns the wait status of the child. */
+
+int waitForeground(pid_t pid)
+{
+	int status;
+	struct rusage usage;
+
+	// since the child process will also run,
+	// block parent until specified process ends
+	waitChild(pid, &status, &usage);
+	endJob(pid, status, &usage);
+	recordStatus(status);
+
+	return status;
+}
+
+
+/* Function that records how a foreground child ended in ENDSTATE.
+ * Takes the wait status of the child. */
+
+void recordStatus(int status)
+{
+	// grab status/signal with macros depending on which used to end process
+	// modify ENDSTATE accordingly
+	if (WIFEXITED(status))
+	{
+		sprintf(ENDSTATE, "exit value %d", WEXITSTATUS(status));
+	}
+	else if (WIFSIGNALED(status))
+	{
+		sprintf(ENDSTATE, "terminated by signal %d", WTERMSIG(status));
+		// we print this immediately for when signal is terminated
+		outPrintf("%s\n", ENDSTATE);
+	}
+}
+
+
+/* Function that prints the information for a background child that has ended.
+ * Takes the process id of the child and its wait status. */
+
+void reportBgExit(pid_t childPid, int status)
+{
+	// use macros to get correct values and print accordingly
+	if (WIFEXITED(status))
+	{
+		outPrintf("background pid %d is done: exit value %d\n", childPid, WEXITSTATUS(status));
+	}
+	else if (WIFSIGNALED(status))
+	{
+		outPrintf("background pid %d is done: terminated by signal %d\n", childPid, WTERMSIG(status));
+	}
+}
+
+
+/* Function that gives a new child the priority it should run with, the background
+ * default for a background child with anything set by 'sched' on top. Since the
+ * child is started with posix_spawn, the priority is applied from the shell right
+ * after it starts. The child is then added to the job table.
+ * Takes the process id of the child, the Command struct it runs and the time it
+ * was started. */
+
+void startJob(pid_t pid, struct Command *cmdInfo, const struct timespec *start)
+{
+	struct Priority prio = { NICE_KEEP, 0, 0, -1 };
+	struct timespec now;
+	struct Job *job;
+	double secs;
+	int i;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	secs = timeDiff(start, &now);
+
+	for (i = 0; i < SPAWN_BUCKETS - 1 && secs > SPAWN_LIMITS[i]; i++);
+
+	metrics.spawnBuckets[i]++;
+	metrics.spawnSecs += secs;
+	metrics.launched++;
+
+	if (cmdInfo->isBgProcess == 1)
+	{
+		prio = BGPRIORITY;
+	}
+
+	if (CMDPRIORITY != NULL)
+	{
+		prio.nice = CMDPRIORITY->nice != NICE_KEEP ? CMDPRIORITY->nice : prio.nice;
+		prio.policy = CMDPRIORITY->policy != -1 ? CMDPRIORITY->policy : prio.policy;
+
+		if (CMDPRIORITY->ioClass != 0)
+		{
+			prio.ioClass = CMDPRIORITY->ioClass;
+			prio.ioLevel = CMDPRIORITY->ioLevel;
+		}
+	}
+
+	if (applyPriority(pid, &prio) == -1)
+	{
+		fprintf(stderr, "%s: cannot set priority\n", cmdInfo->argc > 0 ? cmdInfo->argv[0] : "");
+	}
+
+	if ((JOBCOUNT & (JOBCOUNT - 1)) == 0)
+	{
+		JOBS = realloc(JOBS, (JOBCOUNT ? JOBCOUNT * 2 : 1) * sizeof(struct Job));
+	}
+
+	job = &JOBS[JOBCOUNT++];
+	job->pid = pid;
+	job->name = strdup(cmdInfo->argc > 0 ? cmdInfo->argv[0] : "");
+	job->background = cmdInfo->isBgProcess;
+	job->level = 0;
+	job->start = *start;
+	job->prio = prio;
+}
+
+
+/* Function that removes a child from the job table once it has been reaped and
+ * adds how it went to the statistics for its command name.
+ * Takes the process id of the child, its wait status and resource usage. */
+
+void endJob(pid_t pid, int status, const struct rusage *usage)
+{
+	struct timespec now;
+	struct Stats *stats;
+	struct Name *name;
+	const char *base;
+	double secs;
+	int i;
+
+	metrics.reaped++;
+
+	for (i = 0; i < JOBCOUNT && JOBS[i].pid != pid; i++);
+
+	if (i == JOBCOUNT)
+	{
+		return;
+	}
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	secs = timeDiff(&JOBS[i].start, &now);
+
+	// /bin/ls and ls are counted together
+	base = strrchr(JOBS[i].name, '/');
+	base = base ? base + 1 : JOBS[i].name;
+
+	if (*base != '\0')
+	{
+		name = insertName(base);
+
+		if (name->stats == NULL)
+		{
+			name->stats = calloc(1, sizeof(struct Stats));
+		}
+
+		stats = name->stats;
+		stats->count++;
+		stats->failures += status != 0;
+		stats->maxRss = usage->ru_maxrss > stats->maxRss ? usage->ru_maxrss : stats->maxRss;
+		stats->buckets[statsBucket((uint64_t)(secs * 1e6))]++;
+	}
+
+	free(JOBS[i].name);
+	JOBS[i] = JOBS[--JOBCOUNT];
+}
+
+
+/* Function that finds the histogram bucket for a run time. Times under 16
+ * microseconds get a bucket each, after that every power of two is split into 8
+ * buckets, so a bucket is never more than an eighth wider than its start.
+ * Takes the run time in microseconds.
+ * Returns the bucket index. */
+
+int statsBucket(uint64_t micros)
+{
+	int octave;
+	int index;
+
+	if (micros < 16)
+	{
+		return (int)micros;
+	}
+
+	octave = 63 - __builtin_clzll(micros);
+	index = octave * 8 + (int)((micros >> (octave - 3)) & 7) - 16;
+
+	return index < STATS_BUCKETS ? index : STATS_BUCKETS - 1;
+}
+
+
+/* Function that estimates a percentile of the run times from the histogram, as
+ * the middle of the bucket it falls in.
+ * Takes the statistics and the fraction of runs, like 0.95.
+ * Returns the run time in seconds. */
+
+double statsPercentile(const struct Stats *stats, double fraction)
+{
+	long rank = (long)(fraction * stats->count + 0.999999);
+	long seen = 0;
+	int octave;
+	int i;
+
+	rank = rank < 1 ? 1 : rank;
+
+	for (i = 0; i < STATS_BUCKETS - 1; i++)
+	{
+		seen += stats->buckets[i];
+
+		if (seen >= rank)
+		{
+			break;
+		}
+	}
+
+	if (i < 16)
+	{
+		return (i + 0.5) / 1e6;
+	}
+
+	octave = (i + 16) / 8;
+
+	return ((8 + (i + 16) % 8 + 0.5) * (double)(1ULL << (octave - 3))) / 1e6;
+}
+
+
+/* Function that prints the statistics of every command name in name order.
+ * Takes the file to print to, NULL for the shell's stdout. */
+
+void printStats(FILE *file)
+{
+	struct Name **rows = malloc((names.cap + 1) * sizeof(struct Name *));
+	struct Name *swap;
+	struct Stats *stats;
+	char line[MAX_CMD_CHARS];
+	size_t count = 0;
+	size_t i;
+	size_t j;
+
+	for (i = 0; i < names.cap; i++)
+	{
+		if (names.slots[i].key != NULL && names.slots[i].key != TOMBSTONE && names.slots[i].stats != NULL)
+		{
+			rows[count++] = &names.slots[i];
+		}
+	}
+
+	// few enough names that insertion sort does
+	for (i = 1; i < count; i++)
+	{
+		for (j = i; j > 0 && strcmp(rows[j - 1]->key, rows[j]->key) > 0; j--)
+		{
+			swap = rows[j];
+			rows[j] = rows[j - 1];
+			rows[j - 1] = swap;
+		}
+	}
+
+	for (i = 0; i <= count; i++)
+	{
+		if (i == 0)
+		{
+			snprintf(line, sizeof line, "%-16s %8s %7s %10s %10s %10s %10s\n",
+				"command", "runs", "failed", "p50 s", "p95 s", "p99 s", "max rss kb");
+		}
+		else
+		{
+			stats = rows[i - 1]->stats;
+			snprintf(line, sizeof line, "%-16s %8ld %6.1f%% %10.4f %10.4f %10.4f %10ld\n",
+				rows[i - 1]->key, stats->count, 100.0 * stats->failures / stats->count,
+				statsPercentile(stats, 0.50), statsPercentile(stats, 0.95),
+				statsPercentile(stats, 0.99), stats->maxRss);
+		}
+
+		if (file != NULL)
+		{
+			fputs(line, file);
+		}
+		else
+		{
+			outPrintf("%s", line);
+		}
+	}
+
+	free(rows);
+}
+
+
+/* Function behind the scheduler mode of 'sched -a', which lowers the priority of
+ * background jobs as they run on. After one interval a job moves to SCHED_BATCH at
+ * nice 10 with the lowest best effort I/O priority, and after two to SCHED_IDLE
+ * with idle I/O, so foreground commands started later win the CPU and disk. Each
+ * of the nice value, policy and I/O priority stays as the job was started if that
+ * is already lower. Jobs are only checked when the shell gets back to the prompt. */
+
+void rescheduleJobs()
+{
+	static const struct Priority steps[2] = {
+		{ 10, IOPRIO_CLASS_BE, 7, SCHED_BATCH },
+		{ 19, IOPRIO_CLASS_IDLE, 0, SCHED_IDLE }
+	};
+	struct Priority prio;
+	struct Priority *start;
+	struct timespec now;
+	int level;
+	int i;
+
+	if (AUTOSCHED <= 0 || JOBCOUNT == 0)
+	{
+		return;
+	}
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+
+	for (i = 0; i < JOBCOUNT; i++)
+	{
+		level = (int)(timeDiff(&JOBS[i].start, &now) / AUTOSCHED);
+		level = level > 2 ? 2 : level;
+
+		if (JOBS[i].background == 0 || level <= JOBS[i].level)
+		{
+			continue;
+		}
+
+		// never raise a priority the job was started with
+		prio = steps[level - 1];
+		start = &JOBS[i].prio;
+
+		if (start->nice != NICE_KEEP && start->nice > prio.nice)
+		{
+			prio.nice = start->nice;
+		}
+
+		if (policyRank(start->policy) > policyRank(prio.policy))
+		{
+			prio.policy = start->policy;
+		}
+
+		if (ioRank(start->ioClass, start->ioLevel) > ioRank(prio.ioClass, prio.ioLevel))
+		{
+			prio.ioClass = start->ioClass;
+			prio.ioLevel = start->ioLevel;
+		}
+
+		// a job that ended since the last check is reported on the next one
+		applyPriority(JOBS[i].pid, &prio);
+		JOBS[i].level = level;
+	}
+}
+
+
+/* Function that orders scheduling policies from the highest priority to the lowest.
+ * Takes the policy, -1 for one left alone.
+ * Returns a rank that is larger for lower priority. */
+
+int policyRank(int policy)
+{
+	return policy == SCHED_IDLE ? 2 : policy == SCHED_BATCH ? 1 : 0;
+}
+
+
+/* Function that orders I/O priorities from the highest to the lowest, with one
+ * left alone counted as the default best effort level 4.
+ * Takes the I/O class, 0 for one left alone, and the level within it.
+ * Returns a rank that is larger for lower priority. */
+
+int ioRank(int ioClass, int ioLevel)
+{
+	if (ioClass == IOPRIO_CLASS_IDLE)
+	{
+		return 8;
+	}
+
+	return ioClass == IOPRIO_CLASS_BE ? ioLevel : ioClass == 0 ? 4 : -1;
+}
+
+
+/* Function that sets the nice value, I/O priority and scheduling policy of a
+ * process, leaving alone whatever is marked to keep.
+ * Takes the process id and the priority.
+ * Returns 0 on success or -1 if any of them could not be set. */
+
+int applyPriority(pid_t pid, const struct Priority *prio)
+{
+	struct sched_param param;
+	int result = 0;
+
+	memset(&param, 0, sizeof param);
+
+	if (prio->policy != -1 && sched_setscheduler(pid, prio->policy, &param) == -1)
+	{
+		result = -1;
+	}
+
+	if (prio->nice != NICE_KEEP && setpriority(PRIO_PROCESS, pid, prio->nice) == -1)
+	{
+		result = -1;
+	}
+
+#ifdef SYS_ioprio_set
+	if (prio->ioClass != 0 && syscall(SYS_ioprio_set, IOPRIO_WHO_PROCESS, pid,
+		(prio->ioClass << IOPRIO_CLASS_SHIFT) | prio->ioLevel) == -1)
+	{
+		result = -1;
+	}
+#endif
+
+	return result;
+}
+
+
+/* Function that finishes any shell bookkeeping that must survive exit, such as
+ * flushing the batch journal. Safe to call more than once. */
+
+void shutdownShell()
+{
+	FILE *file;
+
+	outFlush();
+	journalClose();
+	metricsWrite(1);
+	profileWrite();
+	recordClose();
+
+	// written once, even if called again
+	if (STATSPATH != NULL)
+	{
+		file = strcmp(STATSPATH, "-") == 0 ? stderr : fopen(STATSPATH, "w");
+
+		if (file != NULL)
+		{
+			printStats(file);
+
+			if (file != stderr)
+			{
+				fclose(file);
+			}
+		}
+		else
+		{
+			fprintf(stderr, "cannot open %s for job statistics\n", STATSPATH);
+		}
+
+		STATSPATH = NULL;
+	}
+}
+
+
+/* Function that writes the counters in the OpenMetrics text format for a scraper
+ * to pick up. The text goes to a temporary file that is then renamed over the
+ * real one, so readers never see half a file. Writes come at most once every
+ * METRICS_MS unless forced.
+ * Takes bool int of whether to write even if the last write was recent. */
+
+void metricsWrite(int force)
+{
+	char text[4096];
+	char tmpPath[PATH_MAX];
+	struct timespec now;
+	size_t len = 0;
+	long count = 0;
+	long active = 0;
+	int fd;
+	int i;
+
+	if (metrics.path == NULL)
+	{
+		return;
+	}
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+
+	if (force == 0 && metrics.lastWrite.tv_sec != 0
+		&& timeDiff(&metrics.lastWrite, &now) * 1000 < METRICS_MS)
+	{
+		return;
+	}
+
+	metrics.lastWrite = now;
+
+	for (i = 0; i < JOBCOUNT; i++)
+	{
+		active += JOBS[i].background;
+	}
+
+	len += snprintf(text + len, sizeof text - len,
+		"# TYPE smallsh_commands counter\n"
+		"# HELP smallsh_commands Commands run by the shell.\n"
+		"smallsh_commands_total %ld\n"
+		"# TYPE smallsh_children_launched counter\n"
+		"# HELP smallsh_children_launched Child processes started.\n"
+		"smallsh_children_launched_total %ld\n"
+		"# TYPE smallsh_children_reaped counter\n"
+		"# HELP smallsh_children_reaped Child processes waited for after they ended.\n"
+		"smallsh_children_reaped_total %ld\n"
+		"# TYPE smallsh_parse_errors counter\n"
+		"# HELP smallsh_parse_errors Lines and expressions that could not be parsed.\n"
+		"smallsh_parse_errors_total %ld\n"
+		"# TYPE smallsh_background_jobs gauge\n"
+		"# HELP smallsh_background_jobs Background jobs still running.\n"
+		"smallsh_background_jobs %ld\n"
+		"# TYPE smallsh_spawn_latency_seconds histogram\n"
+		"# HELP smallsh_spawn_latency_seconds Time taken to start a child process.\n",
+		metrics.commands, metrics.launched, metrics.reaped, metrics.parseErrors, active);
+
+	// buckets are cumulative
+	for (i = 0; i < SPAWN_BUCKETS; i++)
+	{
+		count += metrics.spawnBuckets[i];
+
+		if (i < SPAWN_BUCKETS - 1)
+		{
+			len += snprintf(text + len, sizeof text - len,
+				"smallsh_spawn_latency_seconds_bucket{le=\"%g\"} %ld\n", SPAWN_LIMITS[i], count);
+		}
+		else
+		{
+			len += snprintf(text + len, sizeof text - len,
+				"smallsh_spawn_latency_seconds_bucket{le=\"+Inf\"} %ld\n", count);
+		}
+	}
+
+	len += snprintf(text + len, sizeof text - len,
+		"smallsh_spawn_latency_seconds_sum %.9f\n"
+		"smallsh_spawn_latency_seconds_count %ld\n"
+		"# EOF\n", metrics.spawnSecs, count);
+
+	snprintf(tmpPath, sizeof tmpPath, "%s.tmp.%d", metrics.path, (int)getpid());
+	fd = open(tmpPath, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+
+	if (fd == -1 || write(fd, text, len) != (ssize_t)len || close(fd) == -1
+		|| rename(tmpPath, metrics.path) == -1)
+	{
+		// tried again on the next round
+		if (fd != -1)
+		{
+			unlink(tmpPath);
+		}
+
+		metrics.lastWrite.tv_sec = 0;
+	}
+}
+
+
+/* Function that waits for a child like wait4, rewriting the metrics file every
+ * METRICS_MS while it blocks so a long command does not leave it stale. SIGCHLD
+ * is held back meanwhile so sigtimedwait can sleep until a child ends.
+ * Takes the process id to wait for or -1 for any child, and where to put its
+ * wait status and resource usage.
+ * Returns the process id reaped, or -1 with errno set. */
+
+pid_t waitChild(pid_t pid, int *status, struct rusage *usage)
+{
+	struct timespec interval = {METRICS_MS / 1000, (METRICS_MS % 1000) * 1000000L};
+	sigset_t chld;
+	sigset_t old;
+	siginfo_t info;
+
+	if (metrics.path == NULL)
+	{
+		return wait4(pid, status, 0, usage);
+	}
+
+	sigemptyset(&chld);
+	sigaddset(&chld, SIGCHLD);
+	sigprocmask(SIG_BLOCK, &chld, &old);
+
+	// peek without reaping, then sleep until the next child ends or the file is due
+	for (;;)
+	{
+		info.si_pid = 0;
+
+		if (waitid(pid == -1 ? P_ALL : P_PID, pid == -1 ? 0 : pid, &info,
+			WEXITED | WNOHANG | WNOWAIT) == -1 || info.si_pid != 0)
+		{
+			break;
+		}
+
+		if (sigtimedwait(&chld, NULL, &interval) == -1 && errno == EAGAIN)
+		{
+			metricsWrite(0);
+		}
+	}
+
+	sigprocmask(SIG_SETMASK, &old, NULL);
+
+	return wait4(pid, status, 0, usage);
+}
+
+
+/* Function behind --profile that starts sampling the shell's own stack PROFILE_HZ
+ * times per second of CPU time it uses. Time spent in children or waiting for
+ * input is not sampled. */
+
+void profileStart()
+{
+	struct sigaction prof;
+	struct itimerval timer;
+	void *warm[4];
+
+	if (profile.path == NULL)
+	{
+		return;
+	}
+
+	// a forked copy of the shell gets these zeroed instead of copying them
+	profile.ring = cacheAlloc(PROFILE_RING * sizeof(struct ProfileSample));
+	profile.cap = 1024;
+	profile.stacks = cacheAlloc(profile.cap * sizeof(struct ProfileSample));
+
+	// the first backtrace loads the unwinder, which is not safe in a handler
+	backtrace(warm, 4);
+
+	memset(&prof, 0, sizeof prof);
+	prof.sa_handler = profileSignal;
+	prof.sa_flags = SA_RESTART;
+	sigfillset(&prof.sa_mask);
+	sigaction(SIGPROF, &prof, NULL);
+
+	timer.it_interval.tv_sec = 0;
+	timer.it_interval.tv_usec = 1000000 / PROFILE_HZ;
+	timer.it_value = timer.it_interval;
+	setitimer(ITIMER_PROF, &timer, NULL);
+}
+
+
+/* Function that handles SIGPROF by recording the interrupted stack in the sample
+ * ring, or counting it as dropped if the ring is full. Only async signal safe
+ * work is done here.
+ * Takes the signal number. */
+
+void profileSignal(int signo)
+{
+	struct ProfileSample *sample;
+	int savedErrno = errno;
+
+	if (profile.head - profile.tail >= PROFILE_RING)
+	{
+		profile.dropped++;
+		errno = savedErrno;
+		return;
+	}
+
+	sample = &profile.ring[profile.head % PROFILE_RING];
+	sample->depth = backtrace(sample->pcs, PROFILE_DEPTH);
+	profile.head++;
+	errno = savedErrno;
+}
+
+
+/* Function that merges the samples in the ring into the table of distinct stacks,
+ * growing the table once it is half full. */
+
+void profileDrain()
+{
+	struct ProfileSample *sample;
+	struct ProfileSample *old;
+	size_t oldCap;
+	size_t slot;
+	size_t i;
+
+	while (profile.tail != profile.head)
+	{
+		sample = &profile.ring[profile.tail % PROFILE_RING];
+
+		if ((profile.used + 1) * 2 > profile.cap)
+		{
+			old = profile.stacks;
+			oldCap = profile.cap;
+			profile.cap *= 2;
+			profile.stacks = cacheAlloc(profile.cap * sizeof(struct ProfileSample));
+
+			for (i = 0; i < oldCap; i++)
+			{
+				if (old[i].depth == 0)
+				{
+					continue;
+				}
+
+				slot = hashBytes(FNV_OFFSET, old[i].pcs, old[i].depth * sizeof(void *)) & (profile.cap - 1);
+
+				while (profile.stacks[slot].depth != 0)
+				{
+					slot = (slot + 1) & (profile.cap - 1);
+				}
+
+				profile.stacks[slot] = old[i];
+			}
+
+			cacheFree(old, oldCap * sizeof(struct ProfileSample));
+		}
+
+		slot = hashBytes(FNV_OFFSET, sample->pcs, sample->depth * sizeof(void *)) & (profile.cap - 1);
+
+		while (profile.stacks[slot].depth != 0 && (profile.stacks[slot].depth != sample->depth
+			|| memcmp(profile.stacks[slot].pcs, sample->pcs, sample->depth * sizeof(void *)) != 0))
+		{
+			slot = (slot + 1) & (profile.cap - 1);
+		}
+
+		if (profile.stacks[slot].depth == 0 && sample->depth > 0)
+		{
+			profile.stacks[slot] = *sample;
+			profile.stacks[slot].count = 0;
+			profile.used++;
+		}
+
+		profile.stacks[slot].count++;
+		profile.tail++;
+	}
+}
+
+
+/* Function that stops the profiler and writes the distinct stacks in the folded
+ * format flame graph tools read, one 'outer;...;inner count' line per stack. The
+ * handler and the signal trampoline frames are left out, and frames without a
+ * symbol are named after their module. Safe to call more than once. */
+
+void profileWrite()
+{
+	struct itimerval off;
+	struct ProfileSample *stack;
+	FILE *file;
+	char **symbols;
+	char *name;
+	char *end;
+	size_t i;
+	int frame;
+
+	if (profile.path == NULL)
+	{
+		return;
+	}
+
+	memset(&off, 0, sizeof off);
+	setitimer(ITIMER_PROF, &off, NULL);
+	profileDrain();
+
+	if ((file = fopen(profile.path, "w")) == NULL)
+	{
+		fprintf(stderr, "cannot open %s for profile\n", profile.path);
+		profile.path = NULL;
+		return;
+	}
+
+	for (i = 0; i < profile.cap; i++)
+	{
+		stack = &profile.stacks[i];
+
+		if (stack->depth <= 2 || (symbols = backtrace_symbols(stack->pcs, stack->depth)) == NULL)
+		{
+			continue;
+		}
+
+		// symbols look like 'module(function+0x1f) [0x4012ab]', outermost frame last
+		for (frame = stack->depth - 1; frame >= 2; frame--)
+		{
+			name = strchr(symbols[frame], '(');
+
+			if (name != NULL && name[1] != '+' && name[1] != ')')
+			{
+				name++;
+				end = name + strcspn(name, "+)");
+			}
+			else
+			{
+				end = name ? name : symbols[frame] + strcspn(symbols[frame], " ");
+				*end = '\0';
+				name = strrchr(symbols[frame], '/');
+				name = name ? name + 1 : symbols[frame];
+			}
+
+			fprintf(file, "%.*s%s", (int)(end - name), name, frame > 2 ? ";" : "");
+		}
+
+		fprintf(file, " %ld\n", stack->count);
+		free(symbols);
+	}
+
+	if (profile.dropped > 0)
+	{
+		fprintf(stderr, "profile: %ld samples dropped\n", profile.dropped);
+	}
+
+	fclose(file);
+	profile.path = NULL;
+}
+
+
+/* Function behind --record that starts the session log.
+ * Takes the path of the log.
+ * Returns 0 on success or -1 if the log could not be opened. */
+
+int recordOpen(const char *path)
+{
+	recorder.file = fopen(path, "w");
+
+	if (recorder.file == NULL)
+	{
+		return -1;
+	}
+
+	fwrite(RECORD_MAGIC, 1, 8, recorder.file);
+
+	return 0;
+}
+
+
+/* Function that adds a record for a command that ran in one or more children,
+ * with the environment changes since the previous record so a replay can start
+ * from an empty environment and still give every command the same one.
+ * Takes the expanded stages, their count and the time the first one started. */
+
+void recordCommand(struct Command **stages, int count, const struct timespec *began)
+{
+	struct timespec now;
+	char *buf = NULL;
+	size_t len = 0;
+	size_t cap = 0;
+	size_t keyLen;
+	uint32_t size;
+	uint32_t changes = 0;
+	int64_t number;
+	int32_t status;
+	int i;
+	int j;
+
+	if (recorder.file == NULL)
+	{
+		return;
+	}
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+
+	// the status would be the previous command's and the time that of the spawn
+	status = stages[0]->isBgProcess ? 0 : lastStatus();
+	number = stages[0]->lineNo;
+	appendText(&buf, &len, &cap, (char *)&number, sizeof number);
+	appendText(&buf, &len, &cap, (char *)&status, sizeof status);
+	number = stages[0]->isBgProcess ? 0 : (int64_t)(timeDiff(began, &now) * 1e9);
+	appendText(&buf, &len, &cap, (char *)&number, sizeof number);
+	putString(&buf, &len, &cap, PWD);
+
+	// the change count is filled in once known
+	appendText(&buf, &len, &cap, (char *)&changes, sizeof changes);
+	size = len - sizeof changes;
+
+	// entries that are new or changed
+	for (i = 0; environ[i] != NULL; i++)
+	{
+		for (j = 0; j < recorder.envCount && strcmp(recorder.env[j], environ[i]) != 0; j++);
+
+		if (j == recorder.envCount)
+		{
+			putString(&buf, &len, &cap, environ[i]);
+			changes++;
+		}
+	}
+
+	// entries that are gone, written as the bare name
+	for (j = 0; j < recorder.envCount; j++)
+	{
+		keyLen = strcspn(recorder.env[j], "=");
+
+		for (i = 0; environ[i] != NULL; i++)
+		{
+			if (strncmp(environ[i], recorder.env[j], keyLen) == 0 && environ[i][keyLen] == '=')
+			{
+				break;
+			}
+		}
+
+		if (environ[i] == NULL)
+		{
+			recorder.env[j][keyLen] = '\0';
+			putString(&buf, &len, &cap, recorder.env[j]);
+			changes++;
+		}
+	}
+
+	memcpy(buf + size, &changes, sizeof changes);
+
+	// keep a copy of the environment for the next record
+	for (j = 0; j < recorder.envCount; j++)
+	{
+		free(recorder.env[j]);
+	}
+
+	for (i = 0; environ[i] != NULL; i++);
+
+	recorder.env = realloc(recorder.env, (i + 1) * sizeof(char *));
+	recorder.envCount = i;
+
+	for (i = 0; i < recorder.envCount; i++)
+	{
+		recorder.env[i] = strdup(environ[i]);
+	}
+
+	// then the stages
+	number = stages[0]->isBgProcess;
+	appendText(&buf, &len, &cap, (char *)&number, sizeof number);
+	size = count;
+	appendText(&buf, &len, &cap, (char *)&size, sizeof size);
+
+	for (i = 0; i < count; i++)
+	{
+		size = stages[i]->argc;
+		appendText(&buf, &len, &cap, (char *)&size, sizeof size);
+
+		for (j = 0; j < stages[i]->argc; j++)
+		{
+			putString(&buf, &len, &cap, stages[i]->argv[j]);
+		}
+
+		putString(&buf, &len, &cap, stages[i]->wantsInputR ? (stages[i]->inRedirFile ? stages[i]->inRedirFile : "") : NULL);
+		putString(&buf, &len, &cap, stages[i]->wantsOutputR ? (stages[i]->outRedirFile ? stages[i]->outRedirFile : "") : NULL);
+	}
+
+	putString(&buf, &len, &cap, LINETEXT);
+
+	size = len;
+	fwrite(&size, sizeof size, 1, recorder.file);
+	fwrite(buf, 1, len, recorder.file);
+	free(buf);
+}
+
+
+/* Function that finishes the session log. Safe to call more than once. */
+
+void recordClose()
+{
+	if (recorder.file != NULL)
+	{
+		fclose(recorder.file);
+		recorder.file = NULL;
+	}
+}
+
+
+/* Function that appends a string to a record, as its length counting the NUL and
+ * then its bytes, or just a 0 length for NULL.
+ * Takes pointers to the record, its length and capacity, and the string. */
+
+void putString(char **buf, size_t *len, size_t *cap, const char *text)
+{
+	uint32_t size = text ? strlen(text) + 1 : 0;
+
+	appendText(buf, len, cap, (char *)&size, sizeof size);
+	appendText(buf, len, cap, text ? text : "", size);
+}
+
+
+/* Function that takes the next string from a record read back into memory.
+ * Takes a pointer to the read position, which is advanced, and the record's end.
+ * Returns the string, NULL for none, or the end of the record if it is cut short. */
+
+const char* getString(const char **p, const char *end)
+{
+	const char *text;
+	uint32_t size;
+
+	if (end - *p < (long)sizeof size)
+	{
+		*p = end;
+		return end;
+	}
+
+	memcpy(&size, *p, sizeof size);
+	*p += sizeof size;
+
+	if (size > (size_t)(end - *p) || (size > 0 && (*p)[size - 1] != '\0'))
+	{
+		*p = end;
+		return end;
+	}
+
+	text = size ? *p : NULL;
+	*p += size;
+
+	return text;
+}
+
+
+/* Function behind --replay that runs the commands of a recorded session again with
+ * the same arguments, environment and working directory, printing how long each
+ * took then and now to stderr, and a total at the end. Background commands are
+ * started again but not timed or compared.
+ * Takes the path of the session log.
+ * Returns 0 if every command exited as it did when recorded, 1 if not, or 2 if
+ * the log could not be read. */
+
+int replaySession(const char *path)
+{
+	struct Command *stages[MAX_CMD_ARGS];
+	struct timespec start;
+	struct timespec stop;
+	FILE *file = fopen(path, "r");
+	char magic[8];
+	char text[MAX_CMD_CHARS];
+	char *buf = NULL;
+	const char *p;
+	const char *end;
+	const char *value;
+	char *equals;
+	uint32_t size;
+	uint32_t changes;
+	uint32_t argc;
+	int64_t lineNo;
+	int64_t nanos;
+	int64_t background;
+	int32_t status;
+	double then;
+	double now;
+	double thenTotal = 0;
+	double nowTotal = 0;
+	long commands = 0;
+	long differ = 0;
+	size_t used;
+	int count;
+	int i;
+	uint32_t j;
+
+	if (file == NULL || fread(magic, 1, 8, file) != 8 || memcmp(magic, RECORD_MAGIC, 8) != 0)
+	{
+		fprintf(stderr, "%s: not a session log\n", path);
+
+		if (file != NULL)
+		{
+			fclose(file);
+		}
+
+		return 2;
+	}
+
+	// the first record brings the whole recorded environment
+	clearenv();
+
+	while (fread(&size, sizeof size, 1, file) == 1)
+	{
+		buf = realloc(buf, size);
+
+		if (fread(buf, 1, size, file) != size || size < 24)
+		{
+			fprintf(stderr, "%s: log is cut short\n", path);
+			break;
+		}
+
+		p = buf;
+		end = buf + size;
+		memcpy(&lineNo, p, sizeof lineNo);
+		memcpy(&status, p + 8, sizeof status);
+		memcpy(&nanos, p + 12, sizeof nanos);
+		p += 20;
+
+		// same directory and environment as when recorded
+		value = getString(&p, end);
+
+		if (value != NULL && value != end && chdir(value) == 0)
+		{
+			snprintf(PWD, sizeof PWD, "%s", value);
+		}
+		else if (value != end)
+		{
+			fprintf(stderr, "line %ld: cannot change to %s\n", (long)lineNo, value ? value : "");
+		}
+
+		changes = 0;
+
+		if (end - p >= (long)sizeof changes)
+		{
+			memcpy(&changes, p, sizeof changes);
+			p += sizeof changes;
+		}
+
+		for (j = 0; j < changes && p < end; j++)
+		{
+			value = getString(&p, end);
+
+			if (value == NULL || value == end)
+			{
+				continue;
+			}
+
+			if ((equals = strchr(value, '=')) != NULL)
+			{
+				*equals = '\0';
+				setenv(value, equals + 1, 1);
+				*equals = '=';
+			}
+			else
+			{
+				unsetenv(value);
+			}
+		}
+
+		// then rebuild the stages
+		count = 0;
+		background = 0;
+
+		if (end - p >= (long)(sizeof background + sizeof size))
+		{
+			memcpy(&background, p, sizeof background);
+			memcpy(&size, p + sizeof background, sizeof size);
+			p += sizeof background + sizeof size;
+		}
+		else
+		{
+			size = 0;
+		}
+
+		for (count = 0; count < (int)size && count < MAX_CMD_ARGS && end - p >= (long)sizeof argc; count++)
+		{
+			stages[count] = malloc(sizeof(struct Command));
+			initCommand(stages[count]);
+			stages[count]->lineNo = lineNo;
+			stages[count]->isBgProcess = background != 0;
+			memcpy(&argc, p, sizeof argc);
+			p += sizeof argc;
+
+			for (j = 0; j < argc && (value = getString(&p, end)) != end; j++)
+			{
+				addArg(stages[count], strdup(value ? value : ""));
+			}
+
+			value = getString(&p, end);
+			stages[count]->wantsInputR = value != NULL && value != end;
+			stages[count]->inRedirFile = stages[count]->wantsInputR && *value ? strdup(value) : NULL;
+			value = getString(&p, end);
+			stages[count]->wantsOutputR = value != NULL && value != end;
+			stages[count]->outRedirFile = stages[count]->wantsOutputR && *value ? strdup(value) : NULL;
+		}
+
+		if (count == 0 || stages[0]->argc == 0)
+		{
+			fprintf(stderr, "line %ld: damaged record skipped\n", (long)lineNo);
+
+			while (count > 0)
+			{
+				freeCommand(stages[--count]);
+			}
+
+			continue;
+		}
+
+		// the command as text for the report, the line as typed if it was logged
+		value = getString(&p, end);
+		used = 0;
+		text[0] = '\0';
+
+		if (value != NULL && value != end)
+		{
+			snprintf(text, sizeof text, "%s", value);
+		}
+
+		for (i = 0; i < count && value != NULL && value != end; i++);
+
+		for (; i < count; i++)
+		{
+			for (j = 0; j < (uint32_t)stages[i]->argc && used < sizeof text; j++)
+			{
+				used += snprintf(text + used, sizeof text - used, "%s%s",
+					j > 0 ? " " : (i > 0 ? " | " : ""), stages[i]->argv[j]);
+			}
+		}
+
+		clock_gettime(CLOCK_MONOTONIC, &start);
+
+		if (count == 1)
+		{
+			runCommand(stages[0]);
+		}
+		else
+		{
+			runStages(stages, count);
+		}
+
+		clock_gettime(CLOCK_MONOTONIC, &stop);
+		outFlush();
+
+		// a background command had no status or run time when it was logged
+		if (background != 0)
+		{
+			fprintf(stderr, "line %ld: started in the background  %s\n", (long)lineNo, text);
+
+			while (count > 0)
+			{
+				freeCommand(stages[--count]);
+			}
+
+			continue;
+		}
+
+		then = nanos / 1e9;
+		now = timeDiff(&start, &stop);
+		thenTotal += then;
+		nowTotal += now;
+		commands++;
+
+		fprintf(stderr, "line %ld: %.6fs then, %.6fs now (%+.1f%%)  %s\n", (long)lineNo, then, now,
+			then > 0 ? (now - then) * 100 / then : 0.0, text);
+
+		if (lastStatus() != status)
+		{
+			fprintf(stderr, "line %ld: exit value %d, was %d\n", (long)lineNo, lastStatus(), (int)status);
+			differ++;
+		}
+
+		while (count > 0)
+		{
+			freeCommand(stages[--count]);
+		}
+	}
+
+	fprintf(stderr, "replayed %ld commands: %.6fs then, %.6fs now (%+.1f%%), %ld exit values differ\n",
+		commands, thenTotal, nowTotal, thenTotal > 0 ? (nowTotal - thenTotal) * 100 / thenTotal : 0.0, differ);
+
+	free(buf);
+	fclose(file);
+
+	return differ > 0;
+}
+
+
+/* Function that opens the batch journal. When resuming, the existing journal is
+ * read first so lines that already completed successfully can be skipped, and
+ * new records are appended after it. Otherwise the journal starts out empty.
+ * Takes the journal path and bool int of whether to resume.
+ * Returns 0 on success or -1 if the journal could not be opened. */
+
+int journalOpen(const char *path, int resume)
+{
+	FILE *old;
+	long lineNo;
+	char state[MAX_CMD_CHARS];
+
+	if (resume == 1 && (old = fopen(path, "r")) != NULL)
+	{
+		// each record is the line number followed by the line's end state
+		while (fscanf(old, "%ld %2047[^\n]", &lineNo, state) == 2)
+		{
+			if (lineNo <= 0 || strcmp(state, "exit value 0") != 0)
+			{
+				continue;
+			}
+
+			// grow the done map to cover this line
+			if (lineNo >= journal.doneSize)
+			{
+				long newSize = journal.doneSize ? journal.doneSize : 1024;
+				char *grown;
+
+				while (newSize <= lineNo)
+				{
+					newSize *= 2;
+				}
+
+				grown = realloc(journal.done, newSize);
+
+				if (grown == NULL)
+				{
+					break;
+				}
+
+				memset(grown + journal.doneSize, 0, newSize - journal.doneSize);
+				journal.done = grown;
+				journal.doneSize = newSize;
+			}
+
+			journal.done[lineNo] = 1;
+		}
+
+		fclose(old);
+	}
+
+	journal.fd = open(path, O_WRONLY | O_CREAT | O_APPEND | (resume ? 0 : O_TRUNC), 0644);
+
+	if (journal.fd == -1)
+	{
+		return -1;
+	}
+
+	fcntl(journal.fd, F_SETFD, FD_CLOEXEC);
+	clock_gettime(CLOCK_MONOTONIC, &journal.lastSync);
+
+	// records left unsynced while a long command runs are synced by a timer
+	memset(&alarmAction, 0, sizeof alarmAction);
+	alarmAction.sa_handler = journalAlarm;
+	alarmAction.sa_flags = SA_RESTART;
+	sigfillset(&alarmAction.sa_mask);
+	sigaction(SIGALRM, &alarmAction, NULL);
+
+	return 0;
+}
+
+
+/* Function that checks if a line already completed successfully in the run being
+ * resumed. Only external commands and pipelines are skipped. Built-ins, functions,
+ * assignments, definitions, loops and case statements run again, as they change
+ * the shell itself, like its directory, variables, aliases and options, which a
+ * new run does not start out with.
+ * Takes the Command struct about to run.
+ * Returns bool int of whether the line should be skipped. */
+
+int journalSkip(struct Command *cmdInfo)
+{
+	struct Command *aliased;
+	struct Name *name;
+	int external;
+
+	if (cmdInfo->lineNo >= journal.doneSize || journal.done[cmdInfo->lineNo] == 0)
+	{
+		return 0;
+	}
+
+	// the stages of a pipeline never run in the shell itself
+	if (cmdInfo->next != NULL)
+	{
+		return 1;
+	}
+
+	if (cmdInfo->type != CMD_SIMPLE || cmdInfo->argc == 0
+		|| isAssignment(cmdInfo->argv[0]))
+	{
+		return 0;
+	}
+
+	// an alias may stand for a built-in
+	aliased = applyAlias(cmdInfo);
+	name = lookupName(aliased ? aliased->argv[0] : cmdInfo->argv[0]);
+	external = name == NULL || (name->function == NULL && name->builtin == NULL);
+	freeCommand(aliased);
+
+	return external;
+}
+
+
+/* Function that appends the outcome of a finished line to the journal. Blank lines,
+ * comments, function definitions and exit are not recorded, and background commands are recorded as
+ * launched so they run again on resume.
+ * Takes the Command struct that was just executed. */
+
+void journalRecord(struct Command *cmdInfo)
+{
+	char record[MAX_CMD_CHARS + 32];
+	int len;
+
+	if (journal.fd == -1 || cmdInfo->argc == 0 || cmdInfo->argv[0][0] == '#'
+		|| cmdInfo->type == CMD_FUNCTION)
+	{
+		return;
+	}
+
+	if (cmdInfo->isBgProcess == 1)
+	{
+		len = snprintf(record, sizeof record, "%ld background\n", cmdInfo->lineNo);
+	}
+	else
+	{
+		len = snprintf(record, sizeof record, "%ld %s\n", cmdInfo->lineNo, ENDSTATE);
+	}
+
+	// O_APPEND keeps each record in one piece even if the shell dies mid-run
+	if (write(journal.fd, record, len) == len)
+	{
+		journal.dirty = 1;
+	}
+
+	journalSync(0);
+}
+
+
+/* Function that commits journal records to disk. Records are grouped so that at
+ * most one fsync happens per sync window, unless forced. Records held back are
+ * synced by SIGALRM when the window ends, even if no record follows them.
+ * Takes bool int of whether to sync regardless of the window. */
+
+void journalSync(int force)
+{
+	struct itimerval timer;
+	struct timespec now;
+	sigset_t alarm;
+	sigset_t saved;
+	long elapsedMs;
+
+	if (journal.fd == -1 || journal.dirty == 0)
+	{
+		return;
+	}
+
+	// the timer must not sync halfway through this
+	sigemptyset(&alarm);
+	sigaddset(&alarm, SIGALRM);
+	sigprocmask(SIG_BLOCK, &alarm, &saved);
+	memset(&timer, 0, sizeof timer);
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	elapsedMs = (long)(timeDiff(&journal.lastSync, &now) * 1000);
+
+	// the timer may have synced the records already
+	if (journal.dirty == 1 && (force == 1 || elapsedMs >= journal.syncMs))
+	{
+		fdatasync(journal.fd);
+		journal.dirty = 0;
+		journal.lastSync = now;
+		setitimer(ITIMER_REAL, &timer, NULL);
+	}
+	else if (journal.dirty == 1)
+	{
+		// sync when the window ends, unless the timer is already set
+		getitimer(ITIMER_REAL, &timer);
+
+		if (timer.it_value.tv_sec == 0 && timer.it_value.tv_usec == 0)
+		{
+			elapsedMs = journal.syncMs - elapsedMs;
+			timer.it_value.tv_sec = elapsedMs / 1000;
+			timer.it_value.tv_usec = elapsedMs % 1000 * 1000 + 1;
+			setitimer(ITIMER_REAL, &timer, NULL);
+		}
+	}
+
+	sigprocmask(SIG_SETMASK, &saved, NULL);
+}
+
+
+/* Function that handles SIGALRM by syncing journal records held back at the end of
+ * their sync window. Only async signal safe work is done here.
+ * Takes the signal number. */
+
+void journalAlarm(int signo)
+{
+	int savedErrno = errno;
+
+	if (journal.fd != -1 && journal.dirty == 1)
+	{
+		fdatasync(journal.fd);
+		journal.dirty = 0;
+		clock_gettime(CLOCK_MONOTONIC, &journal.lastSync);
+	}
+
+	errno = savedErrno;
+}
+
+
+/* Function that syncs any outstanding records and closes the journal. */
+
+void journalClose()
+{
+	if (journal.fd == -1)
+	{
+		return;
+	}
+
+	journalSync(1);
+	close(journal.fd);
+	journal.fd = -1;
+}
+
+
+/* Function that gives the time between two points in seconds.
+ * Takes the start and end times.
+ * Returns the elapsed seconds. */
+
+double timeDiff(const struct timespec *start, const struct timespec *end)
+{
+	return (end->tv_sec - start->tv_sec) + (end->tv_nsec - start->tv_nsec) / 1e9;
+}
+
+
+/* Function that runs the task graph described in a task file. Each task is a
+ * make-like rule line 'name: dep1 dep2' optionally followed by one tab indented
+ * command line, expanded like any other line when the task starts. Tasks are
+ * launched as soon as all of their dependencies have exited successfully, with at
+ * most maxJobs commands running at once. Once a task
+ * fails no new tasks are started. Timing for every task and the critical path are
+ * printed at the end.
+ * Takes the path of the task file and the job limit.
+ * Returns 0 if every task succeeded or 1 otherwise. */
+
+int runTasks(const char *path, int maxJobs)
+{
+	FILE *file;
+	struct Task *tasks = NULL;
+	struct Command *aliased;
+	struct Command *expanded;
+	int count = 0;
+	int running = 0;
+	int failed = 0;
+	int last = -1;
+	int i;
+	int status;
+	struct rusage usage;
+	pid_t pid;
+	struct timespec begin;
+	struct timespec now;
+
+	file = fopen(path, "r");
+
+	if (file == NULL)
+	{
+		fprintf(stderr, "cannot open %s\n", path);
+		return 1;
+	}
+
+	if (loadTasks(file, &tasks, &count) == -1)
+	{
+		fclose(file);
+		return 1;
+	}
+
+	fclose(file);
+	clock_gettime(CLOCK_MONOTONIC, &begin);
+
+	do
+	{
+		// launch every ready task while there are free job slots
+		for (i = 0; i < count && failed == 0 && running < maxJobs; i++)
+		{
+			if (tasks[i].state != TASK_PENDING || tasks[i].waiting > 0)
+			{
+				continue;
+			}
+
+			clock_gettime(CLOCK_MONOTONIC, &tasks[i].start);
+
+			// tasks without a command finish as soon as they are ready
+			if (tasks[i].cmd == NULL)
+			{
+				tasks[i].end = tasks[i].start;
+				tasks[i].state = TASK_DONE;
+				finishTask(tasks, count, i);
+				i = -1;
+				continue;
+			}
+
+			// task lines follow the shell's aliases, quoting and variables
+			aliased = applyAlias(tasks[i].cmd);
+			expanded = expandCommand(aliased ? aliased : tasks[i].cmd);
+			freeCommand(aliased);
+			pid = expanded != NULL && expanded->argc > 0 ? spawnCommand(expanded, -1, -1) : -1;
+			freeCommand(expanded);
+
+			if (pid == -1)
+			{
+				tasks[i].end = tasks[i].start;
+				tasks[i].status = W_EXITCODE(1, 0);
+				tasks[i].state = TASK_FAILED;
+				failed = 1;
+				break;
+			}
+
+			tasks[i].pid = pid;
+			tasks[i].state = TASK_RUNNING;
+			running++;
+		}
+
+		if (running == 0)
+		{
+			break;
+		}
+
+		// wait for any child, background jobs that end meanwhile are reported as usual
+		pid = waitChild(-1, &status, &usage);
+
+		if (pid == -1)
+		{
+			break;
+		}
+
+		endJob(pid, status, &usage);
+
+		for (i = 0; i < count; i++)
+		{
+			if (tasks[i].state == TASK_RUNNING && tasks[i].pid == pid)
+			{
+				break;
+			}
+		}
+
+		if (i == count)
+		{
+			reportBgExit(pid, status);
+			continue;
+		}
+
+		clock_gettime(CLOCK_MONOTONIC, &tasks[i].end);
+		tasks[i].status = status;
+		running--;
+
+		if (WIFEXITED(status) && WEXITSTATUS(status) == 0)
+		{
+			tasks[i].state = TASK_DONE;
+			finishTask(tasks, count, i);
+		}
+		else
+		{
+			tasks[i].state = TASK_FAILED;
+			failed = 1;
+		}
+	}while (1);
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+
+	// print per task timing in file order
+	for (i = 0; i < count; i++)
+	{
+		double secs = timeDiff(&tasks[i].start, &tasks[i].end);
+
+		if (tasks[i].state == TASK_DONE || tasks[i].state == TASK_FAILED)
+		{
+			if (tasks[i].cmd == NULL)
+			{
+				outPrintf("task %s: done\n", tasks[i].name);
+			}
+			else if (WIFSIGNALED(tasks[i].status))
+			{
+				outPrintf("task %s: terminated by signal %d (%.3fs)\n", tasks[i].name,
+					WTERMSIG(tasks[i].status), secs);
+			}
+			else
+			{
+				outPrintf("task %s: exit value %d (%.3fs)\n", tasks[i].name,
+					WIFEXITED(tasks[i].status) ? WEXITSTATUS(tasks[i].status) : 1, secs);
+			}
+		}
+		else
+		{
+			outPrintf("task %s: not run\n", tasks[i].name);
+			failed = 1;
+		}
+
+		// the critical path ends at the finished task with the longest chain
+		if (tasks[i].state == TASK_DONE
+			&& (last == -1 || tasks[i].pathSecs > tasks[last].pathSecs))
+		{
+			last = i;
+		}
+	}
+
+	// print the critical path from its first task to its last
+	if (last != -1)
+	{
+		int chain[count];
+		int length = 0;
+
+		for (i = last; i != -1; i = tasks[i].pathPrev)
+		{
+			chain[length++] = i;
+		}
+
+		outPrintf("critical path:");
+
+		while (length > 0)
+		{
+			length--;
+			outPrintf(" %s%s", tasks[chain[length]].name, length > 0 ? " ->" : "");
+		}
+
+		outPrintf(" (%.3fs of %.3fs)\n", tasks[last].pathSecs, timeDiff(&begin, &now));
+	}
+
+	freeTasks(&tasks, &count);
+
+	return failed;
+}
+
+
+/* Function that reads the rules of a task file into an array of Task structs and
+ * resolves dependency names, rejecting unknown names, cycles and lines too long
+ * to read whole. Nothing is left allocated on failure.
+ * Takes the open task file and pointers to receive the array and task count.
+ * Returns 0 on success or -1 after printing an error. */
+
+int loadTasks(FILE *file, struct Task **tasks, int *count)
+{
+	char line[MAX_CMD_CHARS];
+	char *token;
+	char *colon;
+	struct Task *task = NULL;
+	int capacity = 0;
+	int lineNo = 0;
+	int ready;
+	int i;
+	int j;
+
+	while (fgets(line, sizeof line, file) != NULL)
+	{
+		lineNo++;
+
+		// a line cut short by the buffer would be read as two rules
+		if (strchr(line, '\n') == NULL && feof(file) == 0)
+		{
+			fprintf(stderr, "tasks: line %d: longer than %d characters\n", lineNo,
+				MAX_CMD_CHARS - 2);
+			freeTasks(tasks, count);
+			return -1;
+		}
+
+		// tab indented lines are the command for the rule above them
+		if (line[0] == '\t')
+		{
+			if (strspn(line, DELIM) == strlen(line))
+			{
+				continue;
+			}
+
+			if (task == NULL || task->cmd != NULL)
+			{
+				fprintf(stderr, "tasks: line %d: expected one command per task\n", lineNo);
+				freeTasks(tasks, count);
+				return -1;
+			}
+
+			task->cmd = malloc(sizeof(struct Command));
+			initCommand(task->cmd);
+			if (parseCommand(line, task->cmd) == -1)
+			{
+				freeTasks(tasks, count);
+				return -1;
+			}
+
+			// tasks are waited on by the scheduler, never run in the background
+			task->cmd->isBgProcess = 0;
+
+			if (task->cmd->next != NULL)
+			{
+				fprintf(stderr, "tasks: line %d: pipelines are not supported\n", lineNo);
+				freeTasks(tasks, count);
+				return -1;
+			}
+
+			if (task->cmd->argc == 0)
+			{
+				freeCommand(task->cmd);
+				task->cmd = NULL;
+			}
+
+			continue;
+		}
+
+		// skip blank lines and comments
+		token = line + strspn(line, DELIM);
+
+		if (*token == '\0' || *token == '#')
+		{
+			continue;
+		}
+
+		colon = strchr(token, ':');
+
+		if (colon == NULL)
+		{
+			fprintf(stderr, "tasks: line %d: expected 'name: dependencies'\n", lineNo);
+			freeTasks(tasks, count);
+			return -1;
+		}
+
+		*colon = '\0';
+
+		if (*count == capacity)
+		{
+			struct Task *grown;
+
+			capacity = capacity ? capacity * 2 : 16;
+			grown = realloc(*tasks, capacity * sizeof(struct Task));
+
+			if (grown == NULL)
+			{
+				fprintf(stderr, "tasks: line %d: too many tasks\n", lineNo);
+				freeTasks(tasks, count);
+				return -1;
+			}
+
+			*tasks = grown;
+		}
+
+		task = &(*tasks)[(*count)++];
+		memset(task, 0, sizeof(struct Task));
+		token = strtok(token, DELIM);
+		task->pathPrev = -1;
+
+		if (token == NULL)
+		{
+			fprintf(stderr, "tasks: line %d: missing task name\n", lineNo);
+			freeTasks(tasks, count);
+			return -1;
+		}
+
+		task->name = strdup(token);
+
+		// remaining words after the colon name the dependencies
+		for (token = strtok(colon + 1, DELIM); token != NULL; token = strtok(NULL, DELIM))
+		{
+			if (task->depCount == task->depCap)
+			{
+				int newCap = task->depCap ? task->depCap * 2 : 8;
+				char **names = realloc(task->depNames, newCap * sizeof(char *));
+				int *deps = realloc(task->deps, newCap * sizeof(int));
+
+				// whichever one grew is owned by the task again
+				task->depNames = names ? names : task->depNames;
+				task->deps = deps ? deps : task->deps;
+
+				if (names == NULL || deps == NULL)
+				{
+					fprintf(stderr, "tasks: line %d: too many dependencies\n", lineNo);
+					freeTasks(tasks, count);
+					return -1;
+				}
+
+				task->depCap = newCap;
+			}
+
+			task->depNames[task->depCount++] = strdup(token);
+		}
+	}
+
+	// resolve dependency names to indexes
+	for (i = 0; i < *count; i++)
+	{
+		task = &(*tasks)[i];
+
+		for (j = 0; j < task->depCount; j++)
+		{
+			int k;
+
+			for (k = 0; k < *count && strcmp((*tasks)[k].name, task->depNames[j]) != 0; k++);
+
+			if (k == *count)
+			{
+				fprintf(stderr, "tasks: %s: unknown dependency %s\n", task->name, task->depNames[j]);
+				freeTasks(tasks, count);
+				return -1;
+			}
+
+			task->deps[j] = k;
+		}
+
+		task->waiting = task->depCount;
+	}
+
+	// check for cycles by repeatedly retiring tasks whose dependencies are all retired
+	// the state field is borrowed for this and reset afterwards
+	do
+	{
+		ready = 0;
+
+		for (i = 0; i < *count; i++)
+		{
+			task = &(*tasks)[i];
+
+			if (task->state != TASK_PENDING)
+			{
+				continue;
+			}
+
+			for (j = 0; j < task->depCount && (*tasks)[task->deps[j]].state == TASK_DONE; j++);
+
+			if (j == task->depCount)
+			{
+				task->state = TASK_DONE;
+				ready = 1;
+			}
+		}
+	}while (ready == 1);
+
+	for (i = 0; i < *count; i++)
+	{
+		if ((*tasks)[i].state != TASK_DONE)
+		{
+			fprintf(stderr, "tasks: %s: dependency cycle\n", (*tasks)[i].name);
+			freeTasks(tasks, count);
+			return -1;
+		}
+	}
+
+	for (i = 0; i < *count; i++)
+	{
+		(*tasks)[i].state = TASK_PENDING;
+	}
+
+	return 0;
+}
+
+
+/* Function that records a successfully finished task, extending the longest chain
+ * through it and releasing the tasks that depend on it.
+ * Takes the task array, the task count and the index of the finished task. */
+
+void finishTask(struct Task *tasks, int count, int index)
+{
+	struct Task *task = &tasks[index];
+	int i;
+	int j;
+
+	// longest chain is this task's own time plus the longest chain among its dependencies
+	task->pathSecs = 0;
+
+	for (j = 0; j < task->depCount; j++)
+	{
+		if (tasks[task->deps[j]].pathSecs >= task->pathSecs)
+		{
+			task->pathSecs = tasks[task->deps[j]].pathSecs;
+			task->pathPrev = task->deps[j];
+		}
+	}
+
+	task->pathSecs += timeDiff(&task->start, &task->end);
+
+	for (i = 0; i < count; i++)
+	{
+		for (j = 0; j < tasks[i].depCount; j++)
+		{
+			if (tasks[i].deps[j] == index)
+			{
+				tasks[i].waiting--;
+			}
+		}
+	}
+}
+
+
+/* Function that frees a task array and everything its tasks hold, and empties it.
+ * Takes pointers to the array and its task count. */
+
+void freeTasks(struct Task **tasks, int *count)
+{
+	int i;
+	int j;
+
+	for (i = 0; i < *count; i++)
+	{
+		free((*tasks)[i].name);
+
+		for (j = 0; j < (*tasks)[i].depCount; j++)
+		{
+			free((*tasks)[i].depNames[j]);
+		}
+
+		free((*tasks)[i].depNames);
+		free((*tasks)[i].deps);
+		freeCommand((*tasks)[i].cmd);
+	}
+
+	free(*tasks);
+	*tasks = NULL;
+	*count = 0;
+}
+
+
+/* Function behind the 'cached' prefix. The command's key is a hash of its
+ * arguments, the path and inode, size and mtime of the binary it resolves to, the
+ * working directory, the environment variables named in CACHE_ENV and
+ * SMALLSH_CACHE_ENV, and the contents of its stdin, of its input redirect file and
+ * of every argument that names a regular file (or just their inode, size and mtime
+ * with -s). Files given with -o are what the command writes, they are left out of
+ * the key and their contents are recorded with the output. A command whose stdin
+ * is a pipe, or where the shell reads commands from, runs uncached, as its input
+ * cannot be read for the key without taking it from the command.
+ * With no command, prints the hit and miss counts.
+ * Takes the Command struct whose first argument is 'cached'. */
+
+void runCached(struct Command *cmdInfo)
+{
+	struct PathEntry *binary;
+	struct stat info;
+	int statOnly = 0;
+	int first = 1;
+	int outCount = 0;
+	int i;
+	int j;
+	uint64_t hash = FNV_OFFSET;
+	char *outputs[MAX_CMD_ARGS];
+	char dir[MAX_CMD_CHARS];
+	char names[MAX_CMD_CHARS];
+	char buffer[65536];
+	ssize_t len;
+	const char *path;
+	char *name;
+	char *env;
+	pid_t pid;
+
+	sprintf(ENDSTATE, "exit value 0");
+
+	// options come before the command, each -o takes its file name out of argv
+	while (first < cmdInfo->argc)
+	{
+		if (strcmp(cmdInfo->argv[first], "-s") == 0)
+		{
+			statOnly = 1;
+			first++;
+		}
+		else if (strcmp(cmdInfo->argv[first], "-o") == 0 && first + 1 < cmdInfo->argc
+			&& outCount < MAX_CMD_ARGS)
+		{
+			outputs[outCount++] = cmdInfo->argv[first + 1];
+			cmdInfo->argv[first + 1] = NULL;
+			first += 2;
+		}
+		else
+		{
+			break;
+		}
+	}
+
+	// drop the prefix so the rest is an ordinary command
+	// cached commands always run in the foreground since their output is replayed
+	for (i = 0; i < first; i++)
+	{
+		free(cmdInfo->argv[i]);
+	}
+
+	memmove(cmdInfo->argv, cmdInfo->argv + first, (cmdInfo->argc - first + 1) * sizeof(char *));
+	cmdInfo->argc -= first;
+	cmdInfo->isBgProcess = 0;
+
+	// no command, report the counts
+	if (cmdInfo->argc == 0)
+	{
+		outPrintf("cache: %ld hits, %ld misses\n", CACHEHITS, CACHEMISSES);
+	}
+	// stdin that cannot be read for the key without consuming it runs uncached, a
+	// terminal or /dev/null is not taken as input
+	else if (cmdInfo->wantsInputR == 0 && fstat(0, &info) == 0 && !S_ISCHR(info.st_mode)
+		&& (!S_ISREG(info.st_mode) || (reader.fd == 0 && STDINFRAMES == 0)))
+	{
+		pid = spawnCommand(cmdInfo, -1, -1);
+
+		if (pid == -1)
+		{
+			sprintf(ENDSTATE, "exit value 1");
+		}
+		else
+		{
+			waitForeground(pid);
+		}
+	}
+	else if (cacheDir(dir, sizeof dir) == -1)
+	{
+		fprintf(stderr, "cannot create cache directory %s\n", dir);
+		sprintf(ENDSTATE, "exit value 1");
+	}
+	else
+	{
+		// build the key from everything the command's result can depend on
+		for (i = 0; i < cmdInfo->argc; i++)
+		{
+			hash = hashBytes(hash, cmdInfo->argv[i], strlen(cmdInfo->argv[i]) + 1);
+
+			for (j = 0; j < outCount && strcmp(outputs[j], cmdInfo->argv[i]) != 0; j++);
+
+			if (j == outCount)
+			{
+				hash = hashFile(hash, cmdInfo->argv[i], statOnly);
+			}
+		}
 
-	// pointer to filename for input redirection
-	char *inRedirFile;
+		for (j = 0; j < outCount; j++)
+		{
+			hash = hashBytes(hash, ">", 1);
+			hash = hashBytes(hash, outputs[j], strlen(outputs[j]) + 1);
+		}
 
-	// pointer to filename for output redirection
-	char *outRedirFile;
-};
+		// an upgraded tool gives a new key
+		binary = strchr(cmdInfo->argv[0], '/') ? NULL : pathLookup(cmdInfo->argv[0], 0);
+		path = binary ? binary->path : cmdInfo->argv[0];
 
+		if (path != NULL)
+		{
+			hash = hashBytes(hash, path, strlen(path) + 1);
+			hash = hashFile(hash, path, 1);
+		}
 
-void initCommand(struct Command *cmdInfo);
-void freeCommand(struct Command *garbage);
-struct Command* getCommand();
-int execCommand(struct Command *cmdInfo);
-void cleanUp();
+		if (cmdInfo->wantsInputR == 1 && cmdInfo->inRedirFile != NULL)
+		{
+			hash = hashBytes(hash, "<", 1);
+			hash = hashFile(hash, cmdInfo->inRedirFile, statOnly);
+		}
+		// a file on stdin is hashed from where the command would start reading it,
+		// and left there for the command
+		else if (S_ISREG(info.st_mode))
+		{
+			off_t offset = lseek(0, 0, SEEK_CUR);
 
+			hash = hashBytes(hash, "<", 1);
 
-// global for easy signal handling
-struct sigaction action;
+			while ((len = pread(0, buffer, sizeof buffer, offset)) > 0)
+			{
+				hash = hashBytes(hash, buffer, len);
+				offset += len;
+			}
+		}
 
-// global string that holds process exit/termination state
-char ENDSTATE[MAX_CMD_CHARS] = "NULL";
+		hash = hashBytes(hash, PWD, strlen(PWD) + 1);
 
-int main()
-{
-	// shell loop condition
-	int exitCalled = 0;
+		env = getenv("SMALLSH_CACHE_ENV");
+		snprintf(names, sizeof names, "%s:%s", CACHE_ENV, env ? env : "");
 
-	struct Command *cmdInfo;
+		for (name = strtok(names, ":"); name != NULL; name = strtok(NULL, ":"))
+		{
+			env = getenv(name);
+			hash = hashBytes(hash, name, strlen(name) + 1);
+			hash = hashBytes(hash, env ? env : "", env ? strlen(env) + 1 : 0);
+		}
 
-	// set signal handling to prevent signal interuption
-	// this will be inherited unless changed later
-	action.sa_handler = SIG_IGN;
-	sigaction(SIGINT, &action, NULL);
+		cacheResult(cmdInfo, dir, hash, outputs, outCount);
+	}
 
-	do
+	for (j = 0; j < outCount; j++)
 	{
-		cleanUp();
-		cmdInfo = getCommand();
-		exitCalled = execCommand(cmdInfo);
-		freeCommand(cmdInfo);
-	}while (exitCalled == 0);
-
-	return 0;
+		free(outputs[j]);
+	}
 }
 
 
-/* Function that gives Command struct default values.
- * Takes Command struct allocated in memory. */
+/* Function that finds the cache directory, $SMALLSH_CACHE or ~/.smallsh_cache,
+ * creating it the first time.
+ * Takes the buffer to receive the path and its size.
+ * Returns 0 on success or -1 if the directory could not be created. */
 
-void initCommand(struct Command *cmdInfo)
+int cacheDir(char *dir, size_t size)
 {
-	memset(cmdInfo->argv, 0, sizeof cmdInfo->argv);
+	char *env = getenv("SMALLSH_CACHE");
 
-	cmdInfo->argc = 0;
-	cmdInfo->isBgProcess = 0;
-	cmdInfo->wantsInputR = 0;
-	cmdInfo->wantsOutputR = 0;
-	cmdInfo->inRedirFile = NULL;
-	cmdInfo->outRedirFile = NULL;
+	if (env != NULL)
+	{
+		snprintf(dir, size, "%s", env);
+	}
+	else
+	{
+		snprintf(dir, size, "%s/%s", getenv("HOME") ? getenv("HOME") : ".", CACHE_DIR);
+	}
+
+	return mkdir(dir, 0755) == -1 && errno != EEXIST ? -1 : 0;
 }
 
 
-/* Function that frees memory allocated Command struct.
- * Takes Command struct previously allocated. */
+/* Function that restores the recorded output, output files and exit value of a
+ * cached command on a hit. On a miss the command runs in the foreground with its
+ * output captured into the cache directory and then copied to its real
+ * destination, and the files it wrote are recorded next to it. A result is only
+ * recorded if the command ran to completion and wrote every declared file.
+ * Takes the command without its prefix, the cache directory, the key, and the
+ * files given with -o and their count. */
 
-void freeCommand(struct Command *garbage)
+void cacheResult(struct Command *cmdInfo, const char *dir, uint64_t hash, char **outputs,
+	int outCount)
 {
-	free(garbage);
-}
+	int hit;
+	int fd;
+	int i;
+	int status;
+	char entry[MAX_CMD_CHARS + 24];
+	char outPath[MAX_CMD_CHARS + 32];
+	char tmpPath[MAX_CMD_CHARS + 64];
+	char filePath[MAX_CMD_CHARS + 48];
+	char snapPath[MAX_CMD_CHARS + 64];
+	char statePath[MAX_CMD_CHARS + 32];
+	char names[MAX_CMD_CHARS];
+	char *name;
+	FILE *state;
+	pid_t pid;
 
+	snprintf(entry, sizeof entry, "%s/%016llx", dir, (unsigned long long)hash);
+	snprintf(outPath, sizeof outPath, "%s.out", entry);
+	snprintf(statePath, sizeof statePath, "%s.state", entry);
 
-/* Function that displays the user prompt, gets the user's input, parses out the
- * commands, arguments, and symbols and fills a Command struct with all the
- * pertinent information to be used when executing or running built-ins.
- * Returns a filled Command struct that has been allocated in memory. */
+	// on a hit the state file holds the recorded ENDSTATE
+	state = fopen(statePath, "r");
+	hit = state != NULL && fgets(names, sizeof names, state) != NULL && access(outPath, R_OK) == 0;
 
-struct Command* getCommand()
-{
-	char *token;
-	char input[MAX_CMD_CHARS];
+	for (i = 0; i < outCount && hit == 1; i++)
+	{
+		snprintf(filePath, sizeof filePath, "%s.%d", entry, i);
+		hit = access(filePath, R_OK) == 0;
+	}
 
-	// allocate memory for struct, freed later in main shell loop
-	struct Command *newCmd = malloc(sizeof(struct Command));
+	if (state != NULL)
+	{
+		fclose(state);
+	}
 
-	// set default values of struct
-	initCommand(newCmd);
-	memset(input, '\0', sizeof input);
+	if (hit == 1)
+	{
+		names[strcspn(names, "\n")] = '\0';
+		CACHEHITS++;
 
-	// print the prompt
-	printf(": ");
-	fflush(stdout);
-	fflush(stdin);
+		// put back the files the command wrote
+		for (i = 0; i < outCount; i++)
+		{
+			snprintf(filePath, sizeof filePath, "%s.%d", entry, i);
+			fd = open(outputs[i], O_WRONLY | O_CREAT | O_TRUNC, 0644);
 
-	// get user input
-	fgets(input, MAX_CMD_CHARS, stdin);
+			if (fd == -1 || copyFile(filePath, fd) == -1)
+			{
+				fprintf(stderr, "cannot restore %s\n", outputs[i]);
+				names[0] = '\0';
+			}
 
-	// get the first delimited section of the input
-	token = strtok(input, DELIM);
+			if (fd != -1)
+			{
+				close(fd);
+			}
+		}
 
-	// continue getting token snippets until there are no more
-	while (token)
+		if (names[0] == '\0')
+		{
+			sprintf(ENDSTATE, "exit value 1");
+			return;
+		}
+	}
+	else
 	{
-		// if snippet includes input redirect
-		if (strcmp(token, "<") == 0)
+		CACHEMISSES++;
+
+		// run the command with its output captured into a temporary cache file
+		snprintf(tmpPath, sizeof tmpPath, "%s.tmp.%d", entry, (int)getpid());
+		name = cmdInfo->outRedirFile;
+		cmdInfo->wantsOutputR = 1;
+		cmdInfo->outRedirFile = tmpPath;
+
+		pid = spawnCommand(cmdInfo, -1, -1);
+		cmdInfo->outRedirFile = name;
+		cmdInfo->wantsOutputR = name != NULL;
+
+		if (pid == -1)
 		{
-			// get the next snippet which should be the filename to be used later
-			// and set flag and duplicate string into appropriate struct attribute
-			// strtok will return NULL if no argument is found
-			token = strtok(NULL, DELIM);
-			newCmd->wantsInputR = 1;
-			newCmd->inRedirFile = strdup(token);
+			sprintf(ENDSTATE, "exit value 1");
+			unlink(tmpPath);
+			return;
 		}
-		// if snippet includes output redirect
-		else if (strcmp(token, ">") == 0)
+
+		status = waitForeground(pid);
+		snprintf(names, sizeof names, "%s", ENDSTATE);
+
+		// record the files the command wrote before the output they go with
+		for (i = 0; i < outCount && WIFEXITED(status); i++)
 		{
-			// same as input redirect
-			token = strtok(NULL, DELIM);
-			newCmd->wantsOutputR = 1;
-			newCmd->outRedirFile = strdup(token);
+			snprintf(filePath, sizeof filePath, "%s.%d", entry, i);
+			snprintf(snapPath, sizeof snapPath, "%s.tmp.%d", filePath, (int)getpid());
+			fd = open(snapPath, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+
+			if (fd == -1 || copyFile(outputs[i], fd) == -1 || rename(snapPath, filePath) == -1)
+			{
+				// nothing is recorded for a command that did not write every file
+				status = -1;
+				unlink(snapPath);
+			}
+
+			if (fd != -1)
+			{
+				close(fd);
+			}
 		}
-		// if snippet includes background flag, set struct background flag
-		else if (strcmp(token, "&") == 0)
+
+		// only commands that ran to completion are recorded, the state file last
+		// so a half written entry is never seen as a hit
+		if (WIFEXITED(status) && rename(tmpPath, outPath) == 0)
 		{
-			newCmd->isBgProcess = 1;
+			state = fopen(statePath, "w");
+
+			if (state != NULL)
+			{
+				fprintf(state, "%s\n", ENDSTATE);
+				fclose(state);
+			}
 		}
-		// otherwise, add the argument to the arg array and increment count
 		else
 		{
-			newCmd->argv[newCmd->argc++] = strdup(token);
+			// still deliver whatever output there was
+			outFlush();
+			copyFile(tmpPath, 1);
+			unlink(tmpPath);
+			return;
+		}
+	}
+
+	// deliver the recorded output to where the command would have written it
+	if (cmdInfo->wantsOutputR == 1)
+	{
+		fd = open(cmdInfo->outRedirFile, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+
+		if (fd == -1)
+		{
+			fprintf(stderr, "cannot open %s for output\n", cmdInfo->outRedirFile);
+			sprintf(ENDSTATE, "exit value 1");
+			return;
 		}
 
-		// get next snippet and continue getting snippets until NULL
-		token = strtok(NULL, DELIM);
+		copyFile(outPath, fd);
+		close(fd);
+	}
+	else
+	{
+		outFlush();
+		copyFile(outPath, 1);
 	}
 
-	// once argument array is full, make sure last argument is NULL for exec
-	newCmd->argv[newCmd->argc] = NULL;
+	snprintf(ENDSTATE, sizeof ENDSTATE, "%s", names);
+}
 
-	return(newCmd);
+
+/* Function that folds bytes into a 64 bit FNV-1a hash.
+ * Takes the hash so far, the bytes and their length.
+ * Returns the updated hash. */
+
+uint64_t hashBytes(uint64_t hash, const void *data, size_t len)
+{
+	const unsigned char *bytes = data;
+	size_t i;
+
+	for (i = 0; i < len; i++)
+	{
+		hash = (hash ^ bytes[i]) * FNV_PRIME;
+	}
+
+	return hash;
 }
 
 
-/* Function to execute commands from the array inside the passed struct. First,
- * check if the built-ins were requested and run their logic, or else fork a
- * process and execute normal linux commands with background/foreground and
- * child/parent logic.
- * Takes a filled Command struct with array containing arguments or commands.
- * Returns bool int of whether to continue shell loop or exiting. */
+/* Function that folds a regular file into a hash, either by content or by its
+ * device, inode, size and modification time. Anything that is not a regular
+ * file leaves the hash unchanged.
+ * Takes the hash so far, the path and bool int of whether to use metadata only.
+ * Returns the updated hash. */
 
-int execCommand(struct Command *cmdInfo)
+uint64_t hashFile(uint64_t hash, const char *path, int statOnly)
 {
-	// file descriptor and process id for non built-in command use
+	struct stat info;
+	char buffer[65536];
+	ssize_t len;
 	int fd;
-	pid_t pid;
 
-	// check argument array for built-in commands
-	// if blank line, return 0 to continue shell loop
-	if (cmdInfo->argv[0] == NULL || cmdInfo->argc == 0)
+	if (stat(path, &info) == -1 || !S_ISREG(info.st_mode))
 	{
-		return 0;
+		return hash;
 	}
-	// if a comment, return 0 to continue shell loop
-	else if (strncmp(cmdInfo->argv[0], "#", 1) == 0)
+
+	if (statOnly == 1)
 	{
-		return 0;
+		hash = hashBytes(hash, &info.st_dev, sizeof info.st_dev);
+		hash = hashBytes(hash, &info.st_ino, sizeof info.st_ino);
+		hash = hashBytes(hash, &info.st_size, sizeof info.st_size);
+		return hashBytes(hash, &info.st_mtim, sizeof info.st_mtim);
 	}
-	// if 'exit', terminate process in process group and return 1 to exit shell loop
-	else if (strcmp(cmdInfo->argv[0], "exit") == 0)
+
+	fd = open(path, O_RDONLY);
+
+	if (fd == -1)
 	{
-		// send terminate signal to current process group
-		kill(0, SIGTERM);
-		return 1;
+		return hash;
 	}
-	// if 'status', print ENDSTATE then change ENDSTATE to success
-	// ENDSTATE is automatically modified when non built-in processes are handled
-	else if (strcmp(cmdInfo->argv[0], "status") == 0)
+
+	while ((len = read(fd, buffer, sizeof buffer)) > 0)
 	{
-		fprintf(stdout, "%s\n", ENDSTATE);
-		fflush(stdout);
-		sprintf(ENDSTATE, "exit value 0");
+		hash = hashBytes(hash, buffer, len);
 	}
-	// if 'cd', change directory to either HOME or supplied argument
-	else if (strcmp(cmdInfo->argv[0], "cd") == 0)
-	{
-		char *directory;
 
-		// no argument given, set to HOME environment
-		if (cmdInfo->argv[1] == NULL)
-		{
-			directory = getenv("HOME");
-		}
-		else
-		{
-			directory = cmdInfo->argv[1];
-		}
+	close(fd);
 
-		// change directory to file directory and check for failure
-		// and manually edit ENDSTATE because it is a built-in command
-		sprintf(ENDSTATE, "exit value 0");
+	return hash;
+}
 
-		if (chdir(directory) == -1)
-		{
-			fprintf(stderr, "no such file or directory\n");
-			sprintf(ENDSTATE, "exit value 1");
-		}
-	}
-	// otherwise, the command was not a built-in
-	else
+
+/* Function that copies the contents of a file to a file descriptor.
+ * Takes the path of the file and the descriptor to write to.
+ * Returns 0 on success or -1 on failure. */
+
+int copyFile(const char *path, int toFd)
+{
+	char buffer[65536];
+	ssize_t len;
+	ssize_t done;
+	ssize_t wrote;
+	int fd;
+
+	fd = open(path, O_RDONLY);
+
+	if (fd == -1)
 	{
-		// fork a process
-		// child and parent process will both run unless fork fails
-		pid = fork();
+		return -1;
+	}
 
-		// if it is a child process, we will execute command
-		if (pid == 0)
+	while ((len = read(fd, buffer, sizeof buffer)) > 0)
+	{
+		for (done = 0; done < len; done += wrote)
 		{
-			// if not flagged for background, we set signal handling to default
-			// in order to interupt the signal
-			// background processes will still inherit the SIGINT ignore
-			if (cmdInfo->isBgProcess == 0)
+			wrote = write(toFd, buffer + done, len - done);
+
+			if (wrote == -1)
 			{
-				action.sa_handler = SIG_DFL;
-				action.sa_flags = 0;
-				sigaction(SIGINT, &action, NULL);
+				close(fd);
+				return -1;
 			}
-			// background process have input/output redirected to /dev/null/,
-			// if no file was specified and they want redirection
-			else
-			{
-				if (cmdInfo->inRedirFile == NULL && cmdInfo->wantsInputR == 1)
-				{
-					cmdInfo->inRedirFile = DEVNULL;
-				}
+		}
+	}
 
-				if (cmdInfo->outRedirFile == NULL && cmdInfo->wantsOutputR == 1)
-				{
-					cmdInfo->outRedirFile = DEVNULL;
-				}
-			}
+	close(fd);
 
-			// if there is input redirect, open file and dup2 to copy stdin fd to the fd
-			if (cmdInfo->wantsInputR == 1)
-			{
-				// open the file in read only
-				fd = open(cmdInfo->inRedirFile, O_RDONLY);
+	return len == 0 ? 0 : -1;
+}
 
-				// if there is an error
-				// exit with status 1 so our ENDSTATE will be correct
-				if (fd == -1)
-				{
-					fprintf(stderr, "cannot open %s for input\n", cmdInfo->inRedirFile);
-					exit(1);
-				}
 
-				// otherwise, put stdin file descriptor into the fd
-				if (dup2(fd, 0) == -1)
-				{
-					// check for errors and exit correctly if necessary
-					fprintf(stderr, "dup2 error");
-					exit(1);
-				}
+/* Function that sets up the logical working directory. An inherited PWD is trusted
+ * if it names the directory the shell is actually in, otherwise the kernel is asked
+ * once. Children see the result through the PWD environment variable. */
 
-				// close the fd
-				close(fd);
-			}
+void initDirs()
+{
+	struct stat logical;
+	struct stat actual;
+	char *inherited = getenv("PWD");
 
-			// if there is output redirect, do the same as with input with minor changes
-			if (cmdInfo->wantsOutputR == 1)
-			{
-				// open file and create file if necessary with correct permissions
-				fd = open(cmdInfo->outRedirFile, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+	if (inherited != NULL && inherited[0] == '/' && strlen(inherited) < sizeof PWD
+		&& stat(inherited, &logical) == 0 && stat(".", &actual) == 0
+		&& logical.st_dev == actual.st_dev && logical.st_ino == actual.st_ino)
+	{
+		strcpy(PWD, inherited);
+	}
+	else if (getcwd(PWD, sizeof PWD) == NULL)
+	{
+		strcpy(PWD, "/");
+	}
 
-				if (fd == -1)
-				{
-					fprintf(stderr, "cannot open %s for output\n", cmdInfo->outRedirFile);
-					exit(1);
-				}
+	setenv("PWD", PWD, 1);
+}
 
-				// this time, put stdout file descriptor into the fd
-				if (dup2(fd, 1) == -1)
-				{
-					fprintf(stderr, "dup2 error");
-					exit(1);
-				}
 
-				close(fd);
-			}
+/* Function that changes the working directory and updates the logical path
+ * textually, resolving '.' and '..' against PWD instead of walking the tree with
+ * getcwd. PWD and OLDPWD are updated on success.
+ * Takes the directory to change to.
+ * Returns 0 on success or -1 on failure. */
 
-			// execute the command with PATH variable
-			if (execvp(cmdInfo->argv[0], cmdInfo->argv) < 0)
+int changeDir(const char *target)
+{
+	char path[PATH_MAX * 2];
+	char logical[PATH_MAX];
+	char *parts[PATH_MAX / 2];
+	char *part;
+	int count = 0;
+	int i;
+	size_t len;
+
+	// relative targets are taken from the logical directory
+	if (target[0] == '/')
+	{
+		snprintf(path, sizeof path, "%s", target);
+	}
+	else
+	{
+		snprintf(path, sizeof path, "%s/%s", PWD, target);
+	}
+
+	// split into components, dropping '.' and empty ones and letting '..' undo one
+	for (part = strtok(path, "/"); part != NULL; part = strtok(NULL, "/"))
+	{
+		if (strcmp(part, ".") == 0)
+		{
+			continue;
+		}
+		else if (strcmp(part, "..") == 0)
+		{
+			if (count > 0)
 			{
-				fprintf(stderr, "%s: no such file or directory\n", cmdInfo->argv[0]);
-				exit(1);
+				count--;
 			}
 		}
-		// if it is a parent process, handle foreground/background actions
-		else if (pid > 0)
+		else if (count < (int)(sizeof parts / sizeof parts[0]))
 		{
-			// if it is a foreground process wait for the child to terminate
-			if (cmdInfo->isBgProcess == 0)
-			{
-				int status;
+			parts[count++] = part;
+		}
+	}
 
-				// since the child process will also run,
-				// block parent until specified process ends
-				waitpid(pid, &status, 0);
+	// join the components back into a fresh buffer
+	logical[0] = '\0';
+	len = 0;
 
-				// grab status/signal with macros depending on which used to end process
-				// modify ENDSTATE accordingly
-				if (WIFEXITED(status))
-				{
-					sprintf(ENDSTATE, "exit value %d", WEXITSTATUS(status));
-				}
-				else if (WIFSIGNALED(status))
-				{
-					sprintf(ENDSTATE, "terminated by signal %d", WTERMSIG(status));
-					// we print this immediately for when signal is terminated
-					printf("%s\n", ENDSTATE);
-					fflush(stdout);
-				}
-			}
-			// if it is a background process, just print the pid
-			else
-			{
-				printf("background pid is %d\n", pid);
-				fflush(stdout);
-			}
-		}
-		// otherwise we had a fork error so exit accordingly
-		else
+	for (i = 0; i < count; i++)
+	{
+		len += snprintf(logical + len, sizeof logical - len, "/%s", parts[i]);
+
+		if (len >= sizeof logical)
 		{
-			fprintf(stderr, "fork error");
-			exit(1);
+			errno = ENAMETOOLONG;
+			return -1;
 		}
 	}
 
-	// return 0 to continue the shell loop
+	if (count == 0)
+	{
+		strcpy(logical, "/");
+	}
+
+	if (chdir(logical) == -1)
+	{
+		return -1;
+	}
+
+	setenv("OLDPWD", PWD, 1);
+	strcpy(PWD, logical);
+	setenv("PWD", PWD, 1);
+
 	return 0;
 }
 
 
-/* Function to check for any background children processes that have ended and accordingly
- * print the correct information. This will be run at the beginning of the shell loop before
- * the prompt is displayed. */
+/* Function that prints the working directory followed by the directory stack
+ * from top to bottom. */
 
-void cleanUp()
+void printDirs()
 {
-	int status;
-	pid_t childPid;
+	int i;
 
-	// check if any processes have completed until none are left
-	while ((childPid = waitpid(-1, &status, WNOHANG)) > 0)
+	outPrintf("%s", PWD);
+
+	for (i = DIRCOUNT - 1; i >= 0; i--)
 	{
-		// use macros to get correct values and print accordingly
-		if (WIFEXITED(status))
-		{
-			printf("background pid %d is done: exit value %d\n", childPid, WEXITSTATUS(status));
-		}
-		else if (WIFSIGNALED(status))
-		{
-			printf("background pid %d is done: terminated by signal %d\n", childPid, WTERMSIG(status));
-		}
+		outPrintf(" %s", DIRSTACK[i]);
 	}
+
+	outWrite("\n", 1);
 }